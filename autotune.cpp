@@ -0,0 +1,171 @@
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <map>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include "output.hpp"
+#include "cpuid.hpp"
+#include "topology.hpp"
+#include "shallenge.hpp"
+
+namespace
+{
+    // Number of values of i012 each thread runs per measurement
+    // (2^18 hashes)
+    const uint32_t tune_size = 4096;
+
+    // Number of measurements per kernel, the fastest is used
+    const int tune_repeats = 3;
+
+    // Bumped when kernels are renamed or removed, so that the choices
+    // cached before are timed again
+    const int cache_version = 2;
+
+    // The cache file is a list of "vN cpu<TAB>kernel" lines, where N is
+    // the cache_version. Lines of other versions are dropped.
+    std::filesystem::path cache_path()
+    {
+#if defined(_WIN32)
+        if(const char* dir = std::getenv("LOCALAPPDATA"))
+            return std::filesystem::path(dir) / "shallenge" / "kernels.txt";
+#else
+        if(const char* dir = std::getenv("XDG_CACHE_HOME"))
+            return std::filesystem::path(dir) / "shallenge" / "kernels.txt";
+        if(const char* dir = std::getenv("HOME"))
+            return std::filesystem::path(dir) / ".cache" / "shallenge" / "kernels.txt";
+#endif
+        return {};
+    }
+
+    std::map<std::string, std::string> read_cache(const std::filesystem::path& path)
+    {
+        std::map<std::string, std::string> output;
+        std::ifstream file(path);
+        std::string line;
+        while(std::getline(file, line))
+        {
+            auto tab = line.find('\t');
+            if(tab != std::string::npos && line.starts_with(std::format("v{} ", cache_version)))
+                output[line.substr(0, tab)] = line.substr(tab + 1);
+        }
+        return output;
+    }
+
+    // Failing to write the cache is not an error, the kernels will
+    // just be timed again next time
+    void write_cache(const std::filesystem::path& path, const std::map<std::string, std::string>& cache)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(path.parent_path(), error);
+
+        // Write to a temporary file first, so that another process
+        // never sees a partial file
+        auto temp_path = path;
+        temp_path += ".tmp";
+        {
+            std::ofstream file(temp_path, std::ios::trunc);
+            for(auto& [key, value] : cache)
+                file << key << '\t' << value << '\n';
+            if(!file)
+                return;
+        }
+        std::filesystem::rename(temp_path, path, error);
+    }
+
+    // Run the kernel on all threads at the same time and return the
+    // number of hashes per second. The threads are not running a
+    // search, so the results they submit are dropped.
+    double measure(const Kernel& kernel, const std::array<uint8_t, 64>& block, unsigned long num_threads, const std::vector<int>& cpus)
+    {
+        double best = 0;
+        for(int repeat = 0; repeat < tune_repeats; repeat++)
+        {
+            auto start_time = std::chrono::high_resolution_clock::now();
+            std::vector<std::thread> threads;
+            for(unsigned long i = 0; i < num_threads; i++)
+            {
+                int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+                threads.push_back(std::thread([&kernel, &block, cpu]() {
+                    if(cpu >= 0)
+                        pin_thread(cpu);
+                    kernel.process_chunk(sha256_initial_state, block, 0, tune_size, ChunkOptions());
+                }));
+            }
+            for(auto& thread : threads)
+                thread.join();
+            auto end_time = std::chrono::high_resolution_clock::now();
+
+            std::chrono::duration<double> duration = {end_time - start_time};
+            best = std::max(best, (num_threads * tune_size * 64.0) / duration.count());
+        }
+        return best;
+    }
+}
+
+//
+// Find the fastest kernel for this CPU
+//
+// Which kernel is fastest depends on the latency and throughput of the
+// SHA instructions, and on how the threads share the cores, so the
+// kernels are timed with the number of threads that will be used. The
+// choice is cached per CPU model and number of threads.
+//
+// On hybrid CPUs, each type of core is timed on its own, since the
+// smaller cores have different SHA throughput and latency.
+//
+const Kernel& autotune_kernel(
+    const std::array<uint8_t, 64>& block, unsigned long num_threads, bool retune,
+    const std::vector<int>& cpus, const std::string& cores)
+{
+    auto key = cores.empty()
+        ? std::format("{} ({} threads)", cpu_brand(), num_threads)
+        : std::format("{} ({} threads on {})", cpu_brand(), num_threads, cores);
+    auto cache_key = std::format("v{} {}", cache_version, key);
+    auto path = cache_path();
+    auto cache = path.empty() ? std::map<std::string, std::string>() : read_cache(path);
+
+    if(!retune)
+    {
+        auto it = cache.find(cache_key);
+        if(it != cache.end())
+        {
+            for(auto& kernel : get_kernels())
+            {
+                if(it->second == kernel.name && kernel.supported())
+                    return kernel;
+            }
+        }
+    }
+
+    output_message("Timing the kernels for {}", key);
+
+    const Kernel* best_kernel = nullptr;
+    double best_rate = 0;
+    for(auto& kernel : get_kernels())
+    {
+        if(!kernel.supported())
+            continue;
+
+        double rate = measure(kernel, block, num_threads, cpus);
+        output_message("  {:<10} {:.0f}MH/s", kernel.name, rate / 1e6);
+        if(rate > best_rate)
+        {
+            best_rate = rate;
+            best_kernel = &kernel;
+        }
+    }
+
+    if(!best_kernel)
+        throw std::runtime_error("This CPU supports neither the SHA extensions nor AVX2");
+
+    if(!path.empty())
+    {
+        cache[cache_key] = best_kernel->name;
+        write_cache(path, cache);
+    }
+    return *best_kernel;
+}
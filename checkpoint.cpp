@@ -0,0 +1,136 @@
+#include <cstdio>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <format>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "checkpoint.hpp"
+
+//
+// The checkpoint file is a text file like this:
+//
+//   shallenge-checkpoint 1
+//   user username
+//   seed seed
+//   nonce-length 13
+//   alphabet ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_
+//   shard 3/16
+//   best 00000000 e69407dd 8dd914b8 ddfe27f3 AAAAAABljV0W
+//   best 00000000 757ae4c1 2db70008 6fd25356 AAAAAACLGNW/
+//   done 0 1200
+//   done 1208 1210
+//
+// The nonce-length and alphabet lines are only there if they are not
+// the default of 12 base64 characters, and the shard line only with
+// --shard. Each best line has a result as used by submit_result (A, B,
+// E and F) and the nonce, best first. The done lines are [begin, end)
+// ranges of finished jobs, or of positions in the shard.
+//
+
+void write_checkpoint(const std::string& path, const Checkpoint& checkpoint)
+{
+    std::string text = "shallenge-checkpoint 1\n";
+    text += std::format("user {}\n", checkpoint.user);
+    text += std::format("seed {}\n", checkpoint.seed);
+    if(checkpoint.nonce_length != 12)
+        text += std::format("nonce-length {}\n", checkpoint.nonce_length);
+    if(!checkpoint.alphabet.empty())
+        text += std::format("alphabet {}\n", checkpoint.alphabet);
+    if(checkpoint.num_shards != 1)
+        text += std::format("shard {}/{}\n", checkpoint.shard, checkpoint.num_shards);
+    for(auto& [best, nonce] : checkpoint.best)
+        text += std::format("best {:08x} {:08x} {:08x} {:08x} {}\n", best[0], best[1], best[2], best[3], nonce);
+    for(auto& [begin, end] : checkpoint.done.get())
+        text += std::format("done {} {}\n", begin, end);
+
+    // Write a temporary file, make sure it is on disk and then replace
+    // the old file with it
+    auto temp_path = path + ".tmp";
+    FILE* file = std::fopen(temp_path.c_str(), "wb");
+    if(!file)
+        throw std::runtime_error(std::format("Can't write checkpoint file '{}'", temp_path));
+    bool ok = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+    ok = std::fflush(file) == 0 && ok;
+#if defined(_WIN32)
+    ok = _commit(_fileno(file)) == 0 && ok;
+#else
+    ok = fsync(fileno(file)) == 0 && ok;
+#endif
+    ok = std::fclose(file) == 0 && ok;
+    if(!ok)
+        throw std::runtime_error(std::format("Can't write checkpoint file '{}'", temp_path));
+
+    std::filesystem::rename(temp_path, path);
+}
+
+Checkpoint read_checkpoint(const std::string& path)
+{
+    std::ifstream file(path);
+    if(!file)
+        throw std::runtime_error(std::format("Can't read checkpoint file '{}'", path));
+
+    std::string line;
+    if(!std::getline(file, line) || line != "shallenge-checkpoint 1")
+        throw std::runtime_error(std::format("'{}' is not a checkpoint file", path));
+
+    Checkpoint checkpoint;
+    while(std::getline(file, line))
+    {
+        std::istringstream stream(line);
+        std::string type;
+        stream >> type;
+        if(type == "user")
+        {
+            stream >> checkpoint.user;
+        }
+        else if(type == "seed")
+        {
+            stream >> checkpoint.seed;
+        }
+        else if(type == "nonce-length")
+        {
+            stream >> checkpoint.nonce_length;
+        }
+        else if(type == "alphabet")
+        {
+            stream >> checkpoint.alphabet;
+        }
+        else if(type == "shard")
+        {
+            char slash = 0;
+            stream >> checkpoint.shard >> slash >> checkpoint.num_shards;
+            if(slash != '/' || checkpoint.shard >= checkpoint.num_shards)
+                stream.setstate(std::ios::failbit);
+        }
+        else if(type == "best")
+        {
+            CheckpointResult best;
+            for(auto& value : best.result)
+                stream >> std::hex >> value;
+            stream >> best.nonce;
+            if(best.nonce.size() != checkpoint.nonce_length)
+                stream.setstate(std::ios::failbit);
+            checkpoint.best.push_back(best);
+        }
+        else if(type == "done")
+        {
+            uint64_t begin, end;
+            stream >> begin >> end;
+            checkpoint.done.add(begin, end);
+        }
+        else if(!type.empty())
+        {
+            stream.setstate(std::ios::failbit);
+        }
+
+        if(stream.fail())
+            throw std::runtime_error(std::format("Invalid line '{}' in checkpoint file '{}'", line, path));
+    }
+    return checkpoint;
+}
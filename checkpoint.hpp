@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <string>
+#include <vector>
+#include "ranges.hpp"
+
+// A result and the nonce after the prefix that gave it
+struct CheckpointResult
+{
+    std::array<uint32_t, 4> result;
+    std::string nonce;
+};
+
+// What is needed to continue a search (see checkpoint.cpp)
+struct Checkpoint
+{
+    std::string user;
+    std::string seed;
+
+    // The nonce length and alphabet of the search, empty for base64
+    unsigned nonce_length = 12;
+    std::string alphabet;
+
+    // The shard of the jobs with --shard, 0/1 for all jobs. done has
+    // the positions in the shard.
+    uint64_t shard = 0;
+    uint64_t num_shards = 1;
+
+    // The jobs that are completely done
+    RangeSet done;
+
+    // The best results so far, best first
+    std::vector<CheckpointResult> best;
+};
+
+// Replace the checkpoint file. The file is either the old or the new
+// checkpoint, even if the program is killed while writing it.
+void write_checkpoint(const std::string& path, const Checkpoint& checkpoint);
+
+Checkpoint read_checkpoint(const std::string& path);
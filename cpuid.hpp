@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#if defined(_MSC_VER)
+    int temp[4];
+    __cpuidex(temp, int(leaf), int(subleaf));
+    for(int i = 0; i < 4; i++)
+        regs[i] = uint32_t(temp[i]);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+inline uint64_t xgetbv(uint32_t index)
+{
+#if defined(_MSC_VER)
+    return _xgetbv(index);
+#else
+    uint32_t eax, edx;
+    __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return (uint64_t(edx) << 32) | eax;
+#endif
+}
+
+// SHA extensions (and SSE4.1, which the SHA kernel also uses)
+inline bool cpu_has_sha()
+{
+    uint32_t regs[4];
+    cpuid(0, 0, regs);
+    if(regs[0] < 7)
+        return false;
+    cpuid(1, 0, regs);
+    bool sse41 = (regs[2] >> 19) & 1;
+    cpuid(7, 0, regs);
+    return sse41 && ((regs[1] >> 29) & 1);
+}
+
+// AVX2, including OS support for saving the YMM registers
+inline bool cpu_has_avx2()
+{
+    uint32_t regs[4];
+    cpuid(0, 0, regs);
+    if(regs[0] < 7)
+        return false;
+    cpuid(1, 0, regs);
+    bool osxsave = (regs[2] >> 27) & 1;
+    if(!osxsave || (xgetbv(0) & 6) != 6)
+        return false;
+    cpuid(7, 0, regs);
+    return (regs[1] >> 5) & 1;
+}
+
+// AVX-512 Foundation, including OS support for saving the ZMM and mask
+// registers
+inline bool cpu_has_avx512()
+{
+    uint32_t regs[4];
+    cpuid(0, 0, regs);
+    if(regs[0] < 7)
+        return false;
+    cpuid(1, 0, regs);
+    bool osxsave = (regs[2] >> 27) & 1;
+    if(!osxsave || (xgetbv(0) & 0xe6) != 0xe6)
+        return false;
+    cpuid(7, 0, regs);
+    return (regs[1] >> 16) & 1;
+}
+
+// The CPU model name, e.g. "AMD Ryzen 7 3700X 8-Core Processor"
+inline std::string cpu_brand()
+{
+    uint32_t regs[4];
+    cpuid(0x80000000U, 0, regs);
+    if(regs[0] < 0x80000004U)
+        return "Unknown CPU";
+
+    char brand[49] = { 0 };
+    for(uint32_t i = 0; i < 3; i++)
+    {
+        cpuid(0x80000002U + i, 0, regs);
+        std::memcpy(brand + 16*i, regs, 16);
+    }
+
+    std::string output = brand;
+    output.erase(0, output.find_first_not_of(' '));
+    output.erase(output.find_last_not_of(' ') + 1);
+    return output;
+}
@@ -0,0 +1,222 @@
+#include <cstdint>
+#if defined(_WIN32)
+#include <immintrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#include <array>
+#include "shallenge.hpp"
+
+namespace
+{
+    const uint32_t K[64] = {
+        0x428a2f98U, 0x71374491U, 0xb5c0fbcfU, 0xe9b5dba5U, 0x3956c25bU, 0x59f111f1U, 0x923f82a4U, 0xab1c5ed5U,
+        0xd807aa98U, 0x12835b01U, 0x243185beU, 0x550c7dc3U, 0x72be5d74U, 0x80deb1feU, 0x9bdc06a7U, 0xc19bf174U,
+        0xe49b69c1U, 0xefbe4786U, 0x0fc19dc6U, 0x240ca1ccU, 0x2de92c6fU, 0x4a7484aaU, 0x5cb0a9dcU, 0x76f988daU,
+        0x983e5152U, 0xa831c66dU, 0xb00327c8U, 0xbf597fc7U, 0xc6e00bf3U, 0xd5a79147U, 0x06ca6351U, 0x14292967U,
+        0x27b70a85U, 0x2e1b2138U, 0x4d2c6dfcU, 0x53380d13U, 0x650a7354U, 0x766a0abbU, 0x81c2c92eU, 0x92722c85U,
+        0xa2bfe8a1U, 0xa81a664bU, 0xc24b8b70U, 0xc76c51a3U, 0xd192e819U, 0xd6990624U, 0xf40e3585U, 0x106aa070U,
+        0x19a4c116U, 0x1e376c08U, 0x2748774cU, 0x34b0bcb5U, 0x391c0cb3U, 0x4ed8aa4aU, 0x5b9cca4fU, 0x682e6ff3U,
+        0x748f82eeU, 0x78a5636fU, 0x84c87814U, 0x8cc70208U, 0x90befffaU, 0xa4506cebU, 0xbef9a3f7U, 0xc67178f2U
+    };
+
+    //
+    // Scalar helpers, used for the precalculation
+    //
+
+    inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+    inline uint32_t sigma0(uint32_t x) { return rotr(x, 7) ^ rotr(x, 18) ^ (x >> 3); }
+    inline uint32_t sigma1(uint32_t x) { return rotr(x, 17) ^ rotr(x, 19) ^ (x >> 10); }
+
+    inline uint32_t load_be32(const uint8_t* ptr)
+    {
+        return (uint32_t(ptr[0]) << 24) | (uint32_t(ptr[1]) << 16) | (uint32_t(ptr[2]) << 8) | ptr[3];
+    }
+
+    //
+    // Vector helpers. Each 32-bit lane holds the state of one hash.
+    //
+
+    template<int N> inline __m256i rotr(__m256i x)
+    {
+        return _mm256_or_si256(_mm256_srli_epi32(x, N), _mm256_slli_epi32(x, 32 - N));
+    }
+
+    inline __m256i add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+    inline __m256i bcast(uint32_t x) { return _mm256_set1_epi32(int(x)); }
+
+    inline __m256i sigma0(__m256i x)
+    {
+        return _mm256_xor_si256(_mm256_xor_si256(rotr<7>(x), rotr<18>(x)), _mm256_srli_epi32(x, 3));
+    }
+
+    inline __m256i sigma1(__m256i x)
+    {
+        return _mm256_xor_si256(_mm256_xor_si256(rotr<17>(x), rotr<19>(x)), _mm256_srli_epi32(x, 10));
+    }
+
+    // One round. Only d and h are changed, the caller rotates the
+    // names of the state variables instead of moving the values.
+    inline void sha256_round(
+        __m256i a, __m256i b, __m256i c, __m256i& d,
+        __m256i e, __m256i f, __m256i g, __m256i& h,
+        __m256i kw)
+    {
+        __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(rotr<6>(e), rotr<11>(e)), rotr<25>(e));
+        __m256i ch = _mm256_xor_si256(g, _mm256_and_si256(e, _mm256_xor_si256(f, g)));
+        __m256i T1 = add(add(add(h, S1), ch), kw);
+        __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(rotr<2>(a), rotr<13>(a)), rotr<22>(a));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        d = add(d, T1);
+        h = add(T1, add(S0, maj));
+    }
+}
+
+//
+// Process one chunk without the SHA extensions
+//
+// Same as process_chunk_sha, but the 2^24 hashes are calculated eight at
+// a time using AVX2, one hash in each 32-bit lane. The bytes at
+// position 48-51 (W12 in the message schedule) are different for each
+// lane, everything before that is shared.
+//
+// The first 12 rounds and the message words that don't depend on W12
+// (W16-W18) are precalculated once for the chunk.
+//
+void process_chunk_avx2(
+    const std::array<uint32_t, 8>& initial_state, const std::array<uint8_t, 64>& input_data,
+    uint32_t i012_begin, uint32_t i012_end, const ChunkOptions& options)
+{
+    const uint8_t* alphabet = options.alphabet;
+    uint32_t W[64];
+    for(int i = 0; i < 16; i++)
+        W[i] = load_be32(input_data.data() + 4*i);
+    for(int i = 16; i < 19; i++)
+        W[i] = sigma1(W[i-2]) + W[i-7] + sigma0(W[i-15]) + W[i-16];
+
+    //
+    // Precalculate the first 12 rounds
+    //
+    uint32_t s[8];
+    for(int i = 0; i < 8; i++)
+        s[i] = initial_state[i];
+
+    for(int i = 0; i < 12; i++)
+    {
+        uint32_t S1 = rotr(s[4], 6) ^ rotr(s[4], 11) ^ rotr(s[4], 25);
+        uint32_t ch = s[6] ^ (s[4] & (s[5] ^ s[6]));
+        uint32_t T1 = s[7] + S1 + ch + K[i] + W[i];
+        uint32_t S0 = rotr(s[0], 2) ^ rotr(s[0], 13) ^ rotr(s[0], 22);
+        uint32_t maj = (s[0] & s[1]) | (s[2] & (s[0] | s[1]));
+        for(int j = 7; j > 0; j--)
+            s[j] = s[j-1];
+        s[4] += T1;
+        s[0] = T1 + S0 + maj;
+    }
+
+    // The nonce characters for each lane of the 4th character
+    __m256i lane_chars[8];
+    for(int i = 0; i < 8; i++)
+    {
+        lane_chars[i] = _mm256_setr_epi32(
+            alphabet[8*i+0], alphabet[8*i+1], alphabet[8*i+2], alphabet[8*i+3],
+            alphabet[8*i+4], alphabet[8*i+5], alphabet[8*i+6], alphabet[8*i+7]);
+    }
+
+    // The results are checked on the bits of A given by result_mask,
+    // after adding the initial value
+    const __m256i initial_A = bcast(initial_state[0]);
+    const __m256i mask_A = bcast(options.result_mask);
+
+    for(uint32_t i012 = i012_begin; i012 < i012_end; i012++)
+    {
+        if(options.cancel && options.cancel->load(std::memory_order_relaxed)) [[unlikely]]
+            return;
+
+        // Set the first 3 characters
+        uint8_t v0 = alphabet[(i012>>12) & 63];
+        uint8_t v1 = alphabet[(i012>>6) & 63];
+        uint8_t v2 = alphabet[(i012>>0) & 63];
+        const __m256i base = bcast((uint32_t(v0) << 24) | (uint32_t(v1) << 16) | (uint32_t(v2) << 8));
+
+        for(int i3 = 0; i3 < 8; i3++)
+        {
+            __m256i w[16];
+            for(int i = 0; i < 16; i++)
+                w[i] = bcast(W[i]);
+            w[12] = _mm256_or_si256(base, lane_chars[i3]);
+
+            // The state variables are named so that round 16 starts
+            // with the state in a-h
+            __m256i e = bcast(s[0]), f = bcast(s[1]), g = bcast(s[2]), h = bcast(s[3]);
+            __m256i a = bcast(s[4]), b = bcast(s[5]), c = bcast(s[6]), d = bcast(s[7]);
+
+#define AVX2_ROUND(a, b, c, d, e, f, g, h, t) \
+            if constexpr((t) >= 19) \
+            { \
+                w[(t)&15] = add(add(sigma1(w[((t)-2)&15]), w[((t)-7)&15]), \
+                                add(sigma0(w[((t)-15)&15]), w[(t)&15])); \
+            } \
+            if constexpr((t) == 12 || (t) >= 19) \
+                sha256_round(a, b, c, d, e, f, g, h, add(w[(t)&15], bcast(K[t]))); \
+            else \
+                sha256_round(a, b, c, d, e, f, g, h, bcast(K[t] + W[t]));
+
+#define AVX2_ROUNDS8(t) \
+            AVX2_ROUND(a, b, c, d, e, f, g, h, (t)+0) \
+            AVX2_ROUND(h, a, b, c, d, e, f, g, (t)+1) \
+            AVX2_ROUND(g, h, a, b, c, d, e, f, (t)+2) \
+            AVX2_ROUND(f, g, h, a, b, c, d, e, (t)+3) \
+            AVX2_ROUND(e, f, g, h, a, b, c, d, (t)+4) \
+            AVX2_ROUND(d, e, f, g, h, a, b, c, (t)+5) \
+            AVX2_ROUND(c, d, e, f, g, h, a, b, (t)+6) \
+            AVX2_ROUND(b, c, d, e, f, g, h, a, (t)+7)
+
+            // Rounds 12-15
+            AVX2_ROUND(e, f, g, h, a, b, c, d, 12)
+            AVX2_ROUND(d, e, f, g, h, a, b, c, 13)
+            AVX2_ROUND(c, d, e, f, g, h, a, b, 14)
+            AVX2_ROUND(b, c, d, e, f, g, h, a, 15)
+
+            // Rounds 16-63. W16-W18 are taken from the precalculated
+            // schedule, since they don't depend on W12.
+            w[0] = bcast(W[16]);
+            w[1] = bcast(W[17]);
+            w[2] = bcast(W[18]);
+            AVX2_ROUNDS8(16)
+            AVX2_ROUNDS8(24)
+            AVX2_ROUNDS8(32)
+            AVX2_ROUNDS8(40)
+            AVX2_ROUNDS8(48)
+            AVX2_ROUNDS8(56)
+
+#undef AVX2_ROUNDS8
+#undef AVX2_ROUND
+
+            // Ignore all results that don't start with enough zero bits
+            __m256i masked_A = _mm256_and_si256(add(a, initial_A), mask_A);
+            int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(masked_A, _mm256_setzero_si256())));
+            if(mask == 0)
+                continue;
+
+            alignas(__m256i) uint32_t out_a[8], out_b[8], out_e[8], out_f[8];
+            _mm256_store_si256((__m256i*)out_a, add(a, bcast(initial_state[0])));
+            _mm256_store_si256((__m256i*)out_b, add(b, bcast(initial_state[1])));
+            _mm256_store_si256((__m256i*)out_e, add(e, bcast(initial_state[4])));
+            _mm256_store_si256((__m256i*)out_f, add(f, bcast(initial_state[5])));
+
+            for(int lane = 0; lane < 8; lane++)
+            {
+                if(!(mask & (1 << lane)))
+                    continue;
+
+                std::array<uint8_t, 64> block = input_data;
+                block[48] = v0;
+                block[49] = v1;
+                block[50] = v2;
+                block[51] = alphabet[8*i3 + lane];
+                submit_result({out_a[lane], out_b[lane], out_e[lane], out_f[lane]}, block);
+            }
+        }
+    }
+}
@@ -0,0 +1,329 @@
+#include <utility>
+#include "kernel-sha.hpp"
+
+namespace
+{
+    const uint32_t K[64] = {
+        0x428a2f98U, 0x71374491U, 0xb5c0fbcfU, 0xe9b5dba5U, 0x3956c25bU, 0x59f111f1U, 0x923f82a4U, 0xab1c5ed5U,
+        0xd807aa98U, 0x12835b01U, 0x243185beU, 0x550c7dc3U, 0x72be5d74U, 0x80deb1feU, 0x9bdc06a7U, 0xc19bf174U,
+        0xe49b69c1U, 0xefbe4786U, 0x0fc19dc6U, 0x240ca1ccU, 0x2de92c6fU, 0x4a7484aaU, 0x5cb0a9dcU, 0x76f988daU,
+        0x983e5152U, 0xa831c66dU, 0xb00327c8U, 0xbf597fc7U, 0xc6e00bf3U, 0xd5a79147U, 0x06ca6351U, 0x14292967U,
+        0x27b70a85U, 0x2e1b2138U, 0x4d2c6dfcU, 0x53380d13U, 0x650a7354U, 0x766a0abbU, 0x81c2c92eU, 0x92722c85U,
+        0xa2bfe8a1U, 0xa81a664bU, 0xc24b8b70U, 0xc76c51a3U, 0xd192e819U, 0xd6990624U, 0xf40e3585U, 0x106aa070U,
+        0x19a4c116U, 0x1e376c08U, 0x2748774cU, 0x34b0bcb5U, 0x391c0cb3U, 0x4ed8aa4aU, 0x5b9cca4fU, 0x682e6ff3U,
+        0x748f82eeU, 0x78a5636fU, 0x84c87814U, 0x8cc70208U, 0x90befffaU, 0xa4506cebU, 0xbef9a3f7U, 0xc67178f2U
+    };
+
+    //
+    // Scalar helpers, used for the precalculation
+    //
+
+    inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+    inline uint32_t sigma0(uint32_t x) { return rotr(x, 7) ^ rotr(x, 18) ^ (x >> 3); }
+    inline uint32_t sigma1(uint32_t x) { return rotr(x, 17) ^ rotr(x, 19) ^ (x >> 10); }
+
+    inline uint32_t load_be32(const uint8_t* ptr)
+    {
+        return (uint32_t(ptr[0]) << 24) | (uint32_t(ptr[1]) << 16) | (uint32_t(ptr[2]) << 8) | ptr[3];
+    }
+
+    // The first 3 characters as the high bytes of W12
+    inline uint32_t first_chars(const uint8_t* alphabet, uint32_t i012)
+    {
+        uint32_t v0 = alphabet[(i012>>12) & 63];
+        uint32_t v1 = alphabet[(i012>>6) & 63];
+        uint32_t v2 = alphabet[(i012>>0) & 63];
+        return (v0 << 24) | (v1 << 16) | (v2 << 8);
+    }
+
+    //
+    // Vector helpers. Each 32-bit lane holds the state of one hash.
+    //
+
+    FORCE_INLINE __m512i add(__m512i x, __m512i y) { return _mm512_add_epi32(x, y); }
+    FORCE_INLINE __m512i bcast(uint32_t x) { return _mm512_set1_epi32(int(x)); }
+    FORCE_INLINE __m512i xor3(__m512i x, __m512i y, __m512i z) { return _mm512_ternarylogic_epi32(x, y, z, 0x96); }
+
+    FORCE_INLINE __m512i sigma0(__m512i x)
+    {
+        return xor3(_mm512_ror_epi32(x, 7), _mm512_ror_epi32(x, 18), _mm512_srli_epi32(x, 3));
+    }
+
+    FORCE_INLINE __m512i sigma1(__m512i x)
+    {
+        return xor3(_mm512_ror_epi32(x, 17), _mm512_ror_epi32(x, 19), _mm512_srli_epi32(x, 10));
+    }
+
+    // 16 hashes in AVX-512 vectors, one in each 32-bit lane. Like the
+    // AVX2 kernel, but the rotations and the three input functions
+    // are single instructions. The rounds are calculated 4 at a time,
+    // so that they can be interleaved with the rounds of the SHA lanes
+    // by hash_lanes.
+    struct Lanes16
+    {
+        const std::array<uint32_t, 8>& initial_state;
+        const std::array<uint8_t, 64>& input_data;
+        uint32_t result_mask;
+
+        // The state after 12 rounds, W0-W18 (W12 is not used) and the
+        // 4th character for each group of 16 hashes
+        uint32_t s[8];
+        uint32_t W[19];
+        __m512i chars[4];
+
+        // The state of round t is in v[(0-t)&7] (a) to v[(7-t)&7] (h),
+        // so the state is rotated by the indexing instead of moving
+        // the values
+        __m512i v[8];
+        __m512i w[16];
+
+        Lanes16(const std::array<uint32_t, 8>& state, const std::array<uint8_t, 64>& data, const ChunkOptions& options)
+            : initial_state(state), input_data(data), result_mask(options.result_mask)
+        {
+            for(int i = 0; i < 16; i++)
+                W[i] = load_be32(input_data.data() + 4*i);
+            for(int i = 16; i < 19; i++)
+                W[i] = sigma1(W[i-2]) + W[i-7] + sigma0(W[i-15]) + W[i-16];
+
+            // Precalculate the first 12 rounds
+            for(int i = 0; i < 8; i++)
+                s[i] = initial_state[i];
+
+            for(int i = 0; i < 12; i++)
+            {
+                uint32_t S1 = rotr(s[4], 6) ^ rotr(s[4], 11) ^ rotr(s[4], 25);
+                uint32_t ch = s[6] ^ (s[4] & (s[5] ^ s[6]));
+                uint32_t T1 = s[7] + S1 + ch + K[i] + W[i];
+                uint32_t S0 = rotr(s[0], 2) ^ rotr(s[0], 13) ^ rotr(s[0], 22);
+                uint32_t maj = (s[0] & s[1]) | (s[2] & (s[0] | s[1]));
+                for(int j = 7; j > 0; j--)
+                    s[j] = s[j-1];
+                s[4] += T1;
+                s[0] = T1 + S0 + maj;
+            }
+
+            for(int i = 0; i < 4; i++)
+            {
+                alignas(__m512i) uint32_t c[16];
+                for(int j = 0; j < 16; j++)
+                    c[j] = options.alphabet[16*i + j];
+                chars[i] = _mm512_load_si512(c);
+            }
+        }
+
+        FORCE_INLINE void start(__m512i W12)
+        {
+            for(int i = 0; i < 8; i++)
+                v[(i - 12) & 7] = bcast(s[i]);
+            for(int i = 3; i < 16; i++)
+                w[i] = bcast(W[i]);
+            w[12] = W12;
+
+            // W16-W18 don't depend on W12, and W0-W2 are not needed
+            // from round 19
+            for(int i = 0; i < 3; i++)
+                w[i] = bcast(W[16 + i]);
+        }
+
+        template<int t> FORCE_INLINE void round()
+        {
+            __m512i& a = v[(0-t) & 7];
+            __m512i& b = v[(1-t) & 7];
+            __m512i& c = v[(2-t) & 7];
+            __m512i& d = v[(3-t) & 7];
+            __m512i& e = v[(4-t) & 7];
+            __m512i& f = v[(5-t) & 7];
+            __m512i& g = v[(6-t) & 7];
+            __m512i& h = v[(7-t) & 7];
+
+            __m512i kw;
+            if constexpr(t >= 19)
+            {
+                w[t&15] = add(add(sigma1(w[(t-2)&15]), w[(t-7)&15]), add(sigma0(w[(t-15)&15]), w[t&15]));
+                kw = add(w[t&15], bcast(K[t]));
+            }
+            else if constexpr(t == 12)
+                kw = add(w[12], bcast(K[12]));
+            else
+                kw = bcast(K[t] + W[t]);
+
+            __m512i S1 = xor3(_mm512_ror_epi32(e, 6), _mm512_ror_epi32(e, 11), _mm512_ror_epi32(e, 25));
+            __m512i ch = _mm512_ternarylogic_epi32(e, f, g, 0xca);
+            __m512i T1 = add(add(add(h, S1), ch), kw);
+            __m512i S0 = xor3(_mm512_ror_epi32(a, 2), _mm512_ror_epi32(a, 13), _mm512_ror_epi32(a, 22));
+            __m512i maj = _mm512_ternarylogic_epi32(a, b, c, 0xe8);
+            d = add(d, T1);
+            h = add(T1, add(S0, maj));
+        }
+
+        // Rounds 12+4*G to 15+4*G
+        template<int G> FORCE_INLINE void rounds()
+        {
+            round<12 + 4*G>();
+            round<13 + 4*G>();
+            round<14 + 4*G>();
+            round<15 + 4*G>();
+        }
+
+        // Rounds 12-63
+        FORCE_INLINE void all_rounds()
+        {
+            rounds<0>(); rounds<1>(); rounds<2>(); rounds<3>(); rounds<4>(); rounds<5>(); rounds<6>();
+            rounds<7>(); rounds<8>(); rounds<9>(); rounds<10>(); rounds<11>(); rounds<12>();
+        }
+
+        // Check the results after round 63, where A is in v[0]
+        FORCE_INLINE void check(uint32_t w012, const uint8_t* char3)
+        {
+            // Ignore all results that don't start with enough zero bits
+            __mmask16 zero = _mm512_testn_epi32_mask(add(v[0], bcast(initial_state[0])), bcast(result_mask));
+            if(zero == 0) [[likely]]
+                return;
+
+            alignas(__m512i) uint32_t out_a[16], out_b[16], out_e[16], out_f[16];
+            _mm512_store_si512(out_a, add(v[0], bcast(initial_state[0])));
+            _mm512_store_si512(out_b, add(v[1], bcast(initial_state[1])));
+            _mm512_store_si512(out_e, add(v[4], bcast(initial_state[4])));
+            _mm512_store_si512(out_f, add(v[5], bcast(initial_state[5])));
+
+            for(int lane = 0; lane < 16; lane++)
+            {
+                if(!(zero & (1 << lane)))
+                    continue;
+
+                uint32_t W12 = w012 | char3[lane];
+                std::array<uint8_t, 64> block = input_data;
+                block[48] = uint8_t(W12 >> 24);
+                block[49] = uint8_t(W12 >> 16);
+                block[50] = uint8_t(W12 >> 8);
+                block[51] = uint8_t(W12);
+                submit_result({out_a[lane], out_b[lane], out_e[lane], out_f[lane]}, block);
+            }
+        }
+    };
+}
+
+namespace
+{
+    // Byte swap each lane. AVX-512F has no byte shuffle, so the bytes
+    // are taken from the word rotated right and left by 8 bits.
+    FORCE_INLINE __m512i bswap(__m512i x)
+    {
+        return _mm512_ternarylogic_epi32(_mm512_ror_epi32(x, 8), _mm512_rol_epi32(x, 8), bcast(0x00ff00ffU), 0xd8);
+    }
+
+    // Round t of a whole block, with the state in v as in Lanes16 and
+    // W0-W15 of the block in w
+    template<int t>
+    FORCE_INLINE void block_round(__m512i (&v)[8], __m512i (&w)[16])
+    {
+        __m512i& a = v[(0-t) & 7];
+        __m512i& b = v[(1-t) & 7];
+        __m512i& c = v[(2-t) & 7];
+        __m512i& d = v[(3-t) & 7];
+        __m512i& e = v[(4-t) & 7];
+        __m512i& f = v[(5-t) & 7];
+        __m512i& g = v[(6-t) & 7];
+        __m512i& h = v[(7-t) & 7];
+
+        if constexpr(t >= 16)
+            w[t&15] = add(add(sigma1(w[(t-2)&15]), w[(t-7)&15]), add(sigma0(w[(t-15)&15]), w[t&15]));
+        __m512i kw = add(w[t&15], bcast(K[t]));
+
+        __m512i S1 = xor3(_mm512_ror_epi32(e, 6), _mm512_ror_epi32(e, 11), _mm512_ror_epi32(e, 25));
+        __m512i ch = _mm512_ternarylogic_epi32(e, f, g, 0xca);
+        __m512i T1 = add(add(add(h, S1), ch), kw);
+        __m512i S0 = xor3(_mm512_ror_epi32(a, 2), _mm512_ror_epi32(a, 13), _mm512_ror_epi32(a, 22));
+        __m512i maj = _mm512_ternarylogic_epi32(a, b, c, 0xe8);
+        d = add(d, T1);
+        h = add(T1, add(S0, maj));
+    }
+
+    template<int... t>
+    FORCE_INLINE void block_rounds(__m512i (&v)[8], __m512i (&w)[16], std::integer_sequence<int, t...>)
+    {
+        (block_round<t>(v, w), ...);
+    }
+}
+
+//
+// Process the blocks of 16 messages of the same length, one in each
+// lane (see sha256_process_multi)
+//
+// The words of the blocks are gathered from the 16 messages, so they
+// can be anywhere in memory. The states are only moved between the
+// lanes and memory at the start and the end.
+//
+void sha256_process_avx512_multi(uint32_t* const state[], const uint8_t* const data[], uint32_t length)
+{
+    // The messages as byte offsets from the first one, 8 per gather
+    alignas(__m512i) int64_t offsets[16];
+    for(int l = 0; l < 16; l++)
+        offsets[l] = data[l] - data[0];
+    const __m512i OFFSETS_LO = _mm512_load_si512(&offsets[0]);
+    const __m512i OFFSETS_HI = _mm512_load_si512(&offsets[8]);
+
+    alignas(__m512i) uint32_t temp[16];
+    __m512i v[8], saved[8], w[16];
+    for(int i = 0; i < 8; i++)
+    {
+        for(int l = 0; l < 16; l++)
+            temp[l] = state[l][i];
+        v[i] = _mm512_load_si512(temp);
+    }
+
+    for(uint32_t offset = 0; offset + 64 <= length; offset += 64)
+    {
+        for(int i = 0; i < 16; i++)
+        {
+            const uint8_t* base = data[0] + offset + 4*i;
+            __m256i lo = _mm512_i64gather_epi32(OFFSETS_LO, base, 1);
+            __m256i hi = _mm512_i64gather_epi32(OFFSETS_HI, base, 1);
+            w[i] = bswap(_mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1));
+        }
+
+        for(int i = 0; i < 8; i++)
+            saved[i] = v[i];
+        block_rounds(v, w, std::make_integer_sequence<int, 64>());
+
+        // After 64 rounds, the state is back in v[0] (a) to v[7] (h)
+        for(int i = 0; i < 8; i++)
+            v[i] = add(v[i], saved[i]);
+    }
+
+    for(int i = 0; i < 8; i++)
+    {
+        _mm512_store_si512(temp, v[i]);
+        for(int l = 0; l < 16; l++)
+            state[l][i] = temp[l];
+    }
+}
+
+//
+// Process one chunk with AVX-512
+//
+// Same as process_chunk_avx2, but 16 hashes at a time. This doesn't
+// need the SHA extensions, which the CPUs with AVX-512 before Ice Lake
+// don't have.
+//
+void process_chunk_avx512(
+    const std::array<uint32_t, 8>& state, const std::array<uint8_t, 64>& input_data,
+    uint32_t i012_begin, uint32_t i012_end, const ChunkOptions& options)
+{
+    const uint8_t* alphabet = options.alphabet;
+    Lanes16 lanes(state, input_data, options);
+
+    for(uint32_t i012 = i012_begin; i012 < i012_end; i012++)
+    {
+        if(options.cancel && options.cancel->load(std::memory_order_relaxed)) [[unlikely]]
+            return;
+
+        uint32_t w012 = first_chars(alphabet, i012);
+        for(int i3 = 0; i3 < 64; i3 += 16)
+        {
+            lanes.start(_mm512_or_si512(bcast(w012), lanes.chars[i3/16]));
+            lanes.all_rounds();
+            lanes.check(w012, &alphabet[i3]);
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#include "kernel-sha.hpp"
+
+//
+// Process one chunk
+//
+// This function will check the hash of 2^24 strings (or the part of
+// them given by i012_begin and i012_end). The bytes at position 48-51
+// in the data block will be changed for each string. The hashing
+// starts from the given state, so the data block can be the last block
+// of a longer message.
+//
+// By starting at position 48, the first 12 rounds of the sha256
+// calculation can be precalculated. The parts of the message schedule
+// for rounds 12-19 that don't depend on these bytes are also
+// precalculated.
+//
+// The hashes of the 64 values of the 4th character are calculated in
+// groups of L interleaved lanes. If 64 is not a multiple of L, the last
+// group has fewer lanes.
+//
+// The byte swapped W12 of each hash is the OR of a word for the first
+// 3 characters, made once per i012, and a word from a table for the
+// 4th character. Writing the characters into blocks in memory and
+// loading them back as a vector would stall on store forwarding, so
+// the block is only copied with the characters when a result is
+// submitted.
+//
+// This function is based on the code by Jeffrey Walton (see
+// sha256-x86.cpp).
+//
+template<int L>
+void process_chunk_sha(
+    const std::array<uint32_t, 8>& state, const std::array<uint8_t, 64>& input_data,
+    uint32_t i012_begin, uint32_t i012_end, const ChunkOptions& options)
+{
+    const uint8_t* alphabet = options.alphabet;
+
+    // The 4th character as the low byte of W12
+    __m128i CHAR3[64];
+    for(int i = 0; i < 64; i++)
+        CHAR3[i] = _mm_cvtsi32_si128(alphabet[i]);
+
+    const Precalc pre = precalculate(state, input_data, options);
+    const __m128i W13_15 = pre.W13_15;
+
+    for(uint32_t i012 = i012_begin; i012 < i012_end; i012++)
+    {
+        if(options.cancel && options.cancel->load(std::memory_order_relaxed)) [[unlikely]]
+            return;
+
+        // Set the first 3 characters
+        uint32_t v0 = alphabet[(i012>>12) & 63];
+        uint32_t v1 = alphabet[(i012>>6) & 63];
+        uint32_t v2 = alphabet[(i012>>0) & 63];
+        uint32_t w012 = (v0 << 24) | (v1 << 16) | (v2 << 8);
+        const __m128i W012 = _mm_or_si128(W13_15, _mm_cvtsi32_si128(int(w012)));
+
+        // The inner loop over the 4th character
+        for(int i = 0; i + L <= 64; i += L)
+            hash_lanes<L>(pre, W012, &CHAR3[i], w012, &alphabet[i]);
+        if constexpr(64 % L != 0)
+            hash_lanes<64 % L>(pre, W012, &CHAR3[64 - 64 % L], w012, &alphabet[64 - 64 % L]);
+    }
+}
+
+template void process_chunk_sha<2>(const std::array<uint32_t, 8>&, const std::array<uint8_t, 64>&, uint32_t, uint32_t, const ChunkOptions&);
+template void process_chunk_sha<3>(const std::array<uint32_t, 8>&, const std::array<uint8_t, 64>&, uint32_t, uint32_t, const ChunkOptions&);
+template void process_chunk_sha<4>(const std::array<uint32_t, 8>&, const std::array<uint8_t, 64>&, uint32_t, uint32_t, const ChunkOptions&);
@@ -0,0 +1,272 @@
+#pragma once
+
+// The SHA extension rounds, shared by the kernels in kernel-sha.cpp
+// and kernel-avx512.cpp and by sha256-multi.cpp. Only include this from
+// files built with the SHA extensions enabled.
+
+#include <cstdint>
+#if defined(_WIN32)
+#include <immintrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#include <array>
+#include "shallenge.hpp"
+
+#if defined(_MSC_VER)
+#define FORCE_INLINE __forceinline
+#else
+#define FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace
+{
+    // The state after the first 12 rounds and the precalculated parts
+    // of the message schedule (see process_chunk_sha)
+    struct Precalc
+    {
+        __m128i initial_STATE0;
+        __m128i mask_A;
+        uint32_t result_mask;
+        const std::array<uint8_t, 64>* block;
+        __m128i STATE0;
+        __m128i STATE1;
+        __m128i MSG0;
+        __m128i MSG1;
+        __m128i MSG2;
+        __m128i MSG3;
+        __m128i W13_15;
+    };
+
+    // Check the result to see if it is better than the current best.
+    // Only the first 128 bits of the hash are checked. The caller has
+    // already filtered out most results, so this is the slow path.
+    FORCE_INLINE void check_result(__m128i state0, const Precalc& pre, uint32_t W12)
+    {
+        alignas(__m128i) uint32_t temp[4];
+
+        _mm_store_si128((__m128i*)temp, state0);
+
+        // Ignore all results that don't start with enough zero bits
+        if(temp[3] & pre.result_mask)
+            return;
+
+        // The block only exists as W12 in the hot loop
+        std::array<uint8_t, 64> block = *pre.block;
+        block[48] = uint8_t(W12 >> 24);
+        block[49] = uint8_t(W12 >> 16);
+        block[50] = uint8_t(W12 >> 8);
+        block[51] = uint8_t(W12);
+        submit_result({temp[3], temp[2], temp[1], temp[0]}, block);
+    }
+
+    // Four rounds for each of the L lanes. CUR holds the message words
+    // for these rounds. If msg2 is set, the next words are completed
+    // in NEXT, and if msg1 is set, sha256msg1 is applied to PREV.
+    //
+    // Every step is done for all lanes before the next step. Each
+    // operation in the sha256 usually depends on the previous one, so
+    // interleaving the lanes hides the latency.
+    template<int L, bool msg1, bool msg2>
+    FORCE_INLINE void rounds4(
+        __m128i (&STATE0)[L], __m128i (&STATE1)[L],
+        __m128i (&PREV)[L], const __m128i (&CUR)[L], __m128i (&NEXT)[L],
+        __m128i K)
+    {
+        __m128i MSG[L];
+
+        for(int l = 0; l < L; l++)
+            MSG[l] = _mm_add_epi32(CUR[l], K);
+        for(int l = 0; l < L; l++)
+            STATE1[l] = _mm_sha256rnds2_epu32(STATE1[l], STATE0[l], MSG[l]);
+        if constexpr(msg2)
+        {
+            for(int l = 0; l < L; l++)
+                NEXT[l] = _mm_add_epi32(NEXT[l], _mm_alignr_epi8(CUR[l], PREV[l], 4));
+            for(int l = 0; l < L; l++)
+                NEXT[l] = _mm_sha256msg2_epu32(NEXT[l], CUR[l]);
+        }
+        for(int l = 0; l < L; l++)
+            MSG[l] = _mm_shuffle_epi32(MSG[l], 0x0E);
+        for(int l = 0; l < L; l++)
+            STATE0[l] = _mm_sha256rnds2_epu32(STATE0[l], STATE1[l], MSG[l]);
+        if constexpr(msg1)
+        {
+            for(int l = 0; l < L; l++)
+                PREV[l] = _mm_sha256msg1_epu32(PREV[l], CUR[l]);
+        }
+    }
+
+    // Calculate the hash of L blocks at the same time and check the
+    // results. Only bytes 48-51 (W12) differ from the precalculated
+    // block. W13-W15 and the first 3 characters are in W012, and the
+    // 4th character of each lane is in the low word of CHAR3[l], so
+    // W12-W15 are built with one OR per lane without going through
+    // memory. The characters are also given as plain integers for
+    // the slow path.
+    template<int L>
+    FORCE_INLINE void hash_lanes(const Precalc& pre, __m128i W012, const __m128i* CHAR3, uint32_t w012, const uint8_t* char3)
+    {
+        __m128i STATE0[L], STATE1[L], MSG[L], MSG0[L], MSG1[L], MSG2[L], MSG3[L];
+
+        /* Set start state */
+        for(int l = 0; l < L; l++)
+        {
+            STATE0[l] = pre.STATE0;
+            STATE1[l] = pre.STATE1;
+        }
+
+        /* Rounds 12-15 */
+        for(int l = 0; l < L; l++)
+            MSG3[l] = _mm_or_si128(W012, CHAR3[l]);
+        for(int l = 0; l < L; l++)
+            MSG[l] = _mm_add_epi32(MSG3[l], _mm_set_epi64x(0xC19BF1749BDC06A7ULL, 0x80DEB1FE72BE5D74ULL));
+        for(int l = 0; l < L; l++)
+            STATE1[l] = _mm_sha256rnds2_epu32(STATE1[l], STATE0[l], MSG[l]);
+        for(int l = 0; l < L; l++)
+            MSG0[l] = _mm_add_epi32(pre.MSG0, _mm_slli_si128(MSG3[l], 12));
+        for(int l = 0; l < L; l++)
+            MSG[l] = _mm_shuffle_epi32(MSG[l], 0x0E);
+        for(int l = 0; l < L; l++)
+            STATE0[l] = _mm_sha256rnds2_epu32(STATE0[l], STATE1[l], MSG[l]);
+        for(int l = 0; l < L; l++)
+            MSG2[l] = _mm_sha256msg1_epu32(pre.MSG2, MSG3[l]);
+
+        /* Rounds 16-19 */
+        for(int l = 0; l < L; l++)
+            MSG[l] = _mm_add_epi32(MSG0[l], _mm_set_epi64x(0x240CA1CC0FC19DC6ULL, 0xEFBE4786E49B69C1ULL));
+        for(int l = 0; l < L; l++)
+            STATE1[l] = _mm_sha256rnds2_epu32(STATE1[l], STATE0[l], MSG[l]);
+        for(int l = 0; l < L; l++)
+            MSG1[l] = _mm_sha256msg2_epu32(pre.MSG1, MSG0[l]);
+        for(int l = 0; l < L; l++)
+            MSG[l] = _mm_shuffle_epi32(MSG[l], 0x0E);
+        for(int l = 0; l < L; l++)
+            STATE0[l] = _mm_sha256rnds2_epu32(STATE0[l], STATE1[l], MSG[l]);
+        for(int l = 0; l < L; l++)
+            MSG3[l] = _mm_add_epi32(MSG3[l], pre.MSG3);
+
+        /* Rounds 20-63 */
+        rounds4<L, true, true>(STATE0, STATE1, MSG0, MSG1, MSG2, _mm_set_epi64x(0x76F988DA5CB0A9DCULL, 0x4A7484AA2DE92C6FULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG1, MSG2, MSG3, _mm_set_epi64x(0xBF597FC7B00327C8ULL, 0xA831C66D983E5152ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG2, MSG3, MSG0, _mm_set_epi64x(0x1429296706CA6351ULL, 0xD5A79147C6E00BF3ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG3, MSG0, MSG1, _mm_set_epi64x(0x53380D134D2C6DFCULL, 0x2E1B213827B70A85ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG0, MSG1, MSG2, _mm_set_epi64x(0x92722C8581C2C92EULL, 0x766A0ABB650A7354ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG1, MSG2, MSG3, _mm_set_epi64x(0xC76C51A3C24B8B70ULL, 0xA81A664BA2BFE8A1ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG2, MSG3, MSG0, _mm_set_epi64x(0x106AA070F40E3585ULL, 0xD6990624D192E819ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG3, MSG0, MSG1, _mm_set_epi64x(0x34B0BCB52748774CULL, 0x1E376C0819A4C116ULL));
+        rounds4<L, false, true>(STATE0, STATE1, MSG0, MSG1, MSG2, _mm_set_epi64x(0x682E6FF35B9CCA4FULL, 0x4ED8AA4A391C0CB3ULL));
+        rounds4<L, false, true>(STATE0, STATE1, MSG1, MSG2, MSG3, _mm_set_epi64x(0x8CC7020884C87814ULL, 0x78A5636F748F82EEULL));
+        rounds4<L, false, false>(STATE0, STATE1, MSG2, MSG3, MSG0, _mm_set_epi64x(0xC67178F2BEF9A3F7ULL, 0xA4506CEB90BEFFFAULL));
+
+        // Check the bits of A (lane 3) given by result_mask after adding
+        // the initial state. Test all lanes at once and only look at
+        // them one at a time if one of them has a chance.
+        const __m128i ZERO = _mm_setzero_si128();
+        __m128i ZERO_A = ZERO;
+        for(int l = 0; l < L; l++)
+        {
+            __m128i A = _mm_and_si128(_mm_add_epi32(STATE0[l], pre.initial_STATE0), pre.mask_A);
+            ZERO_A = _mm_or_si128(ZERO_A, _mm_cmpeq_epi32(A, ZERO));
+        }
+        if(_mm_testz_si128(ZERO_A, _mm_set_epi32(-1, 0, 0, 0))) [[likely]]
+            return;
+
+        /* Combine state  */
+        for(int l = 0; l < L; l++)
+            check_result(_mm_add_epi32(STATE0[l], pre.initial_STATE0), pre, w012 | char3[l]);
+    }
+
+    // Precalculate the first 12 rounds and the parts of the message
+    // schedule for rounds 12-19 that don't depend on W12 (see
+    // process_chunk_sha)
+    inline Precalc precalculate(
+        const std::array<uint32_t, 8>& state, const std::array<uint8_t, 64>& input_data, const ChunkOptions& options)
+    {
+        const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+        Precalc pre;
+
+        __m128i STATE0, STATE1;
+        __m128i MSG,MSG0,MSG1,MSG2,MSG3,TMP;
+
+        // Set initial state
+        TMP = _mm_loadu_si128((const __m128i*) &state[0]);
+        STATE1 = _mm_loadu_si128((const __m128i*) &state[4]);
+
+        TMP = _mm_shuffle_epi32(TMP, 0xB1);          /* CDAB */
+        STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);    /* EFGH */
+        STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);    /* ABEF */
+        STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0); /* CDGH */
+
+        pre.initial_STATE0 = STATE0;
+        pre.result_mask = options.result_mask;
+        pre.block = &input_data;
+        pre.mask_A = _mm_set_epi32(int(options.result_mask), 0, 0, 0);
+
+        //
+        // Precalculate the first 12 rounds
+        //
+
+        /* Rounds 0-3 */
+        MSG = _mm_loadu_si128((const __m128i*) (input_data.data()+0));
+        MSG0 = _mm_shuffle_epi8(MSG, MASK);
+        MSG = _mm_add_epi32(MSG0, _mm_set_epi64x(0xE9B5DBA5B5C0FBCFULL, 0x71374491428A2F98ULL));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+
+        /* Rounds 4-7 */
+        MSG1 = _mm_loadu_si128((const __m128i*) (input_data.data()+16));
+        MSG1 = _mm_shuffle_epi8(MSG1, MASK);
+        MSG = _mm_add_epi32(MSG1, _mm_set_epi64x(0xAB1C5ED5923F82A4ULL, 0x59F111F13956C25BULL));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG0 = _mm_sha256msg1_epu32(MSG0, MSG1);
+
+        /* Rounds 8-11 */
+        MSG2 = _mm_loadu_si128((const __m128i*) (input_data.data()+32));
+        MSG2 = _mm_shuffle_epi8(MSG2, MASK);
+        MSG = _mm_add_epi32(MSG2, _mm_set_epi64x(0x550C7DC3243185BEULL, 0x12835B01D807AA98ULL));
+        STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+        MSG = _mm_shuffle_epi32(MSG, 0x0E);
+        STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+        MSG1 = _mm_sha256msg1_epu32(MSG1, MSG2);
+
+        // Save state after round 12
+        pre.STATE0 = STATE0;
+        pre.STATE1 = STATE1;
+        pre.MSG2 = MSG2;
+
+        //
+        // Precalculate the message schedule for rounds 12-19
+        //
+        // Only W12 changes between the hashes. W16-W18 don't depend on
+        // it, and W19 and the sha256msg1 of W12-W15 only depend on it
+        // through a plain addition. So these are calculated once with W12
+        // set to 0, and W12 is added in hash_lanes.
+        //
+
+        MSG3 = _mm_loadu_si128((const __m128i*) (input_data.data()+48));
+        MSG3 = _mm_shuffle_epi8(MSG3, MASK);
+        MSG3 = _mm_blend_epi16(MSG3, _mm_setzero_si128(), 0x03);
+        pre.W13_15 = MSG3;
+
+        // W16-W19 (without W12)
+        TMP = _mm_alignr_epi8(MSG3, MSG2, 4);
+        MSG0 = _mm_add_epi32(MSG0, TMP);
+        MSG0 = _mm_sha256msg2_epu32(MSG0, MSG3);
+        pre.MSG0 = MSG0;
+
+        // Input to sha256msg2 for W20-W23. Only depends on W13-W16.
+        TMP = _mm_alignr_epi8(MSG0, MSG3, 4);
+        pre.MSG1 = _mm_add_epi32(MSG1, TMP);
+
+        // sigma0 of W13-W16, so that sha256msg1 of W12-W15 becomes a
+        // single addition
+        pre.MSG3 = _mm_sub_epi32(_mm_sha256msg1_epu32(MSG3, MSG0), MSG3);
+
+        return pre;
+    }
+}
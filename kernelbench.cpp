@@ -0,0 +1,307 @@
+#include <cstdint>
+#if defined(_WIN32)
+#define _CRT_SECURE_NO_WARNINGS
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <fstream>
+#include <list>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "print.hpp"
+#include "cpuid.hpp"
+#include "shallenge.hpp"
+#include "topology.hpp"
+
+//
+// Times the kernels on one thread for a fixed number of hashes, so that
+// changes to a kernel can be compared without the scheduling, the other
+// threads and turbo of the full search getting in the way.
+//
+// The cycles are counted with rdtsc, which runs at a fixed rate on all
+// current CPUs. It is not the core clock, so the cycles per hash are only
+// comparable between runs on the same machine.
+//
+
+namespace
+{
+    // The results the kernels find are only counted
+    uint64_t num_results = 0;
+
+    struct Settings
+    {
+        std::vector<std::string> kernels;
+        uint32_t num_i012 = 65536;
+        unsigned long repeats = 10;
+        int cpu = -1;
+        std::string json;
+    };
+
+    // The mean and sample variance of the runs of a kernel, per hash
+    struct Result
+    {
+        std::string name;
+        double cycles;
+        double cycles_min;
+        double cycles_variance;
+        double ns;
+        double ns_min;
+        double ns_variance;
+    };
+
+    void mean_and_variance(const std::vector<double>& values, double& mean, double& variance)
+    {
+        mean = 0;
+        for(auto value : values)
+            mean += value;
+        mean /= double(values.size());
+
+        variance = 0;
+        for(auto value : values)
+            variance += (value - mean) * (value - mean);
+        variance = values.size() > 1 ? variance / double(values.size() - 1) : 0;
+    }
+
+    // The same message as shallenge --benchmark, which fits in one block
+    std::array<uint8_t, 64> create_block()
+    {
+        std::string prefix = "benchmark/shallenge/";
+        prefix.resize(40, '/');
+
+        std::array<uint8_t, 64> block { 0 };
+        std::copy(prefix.begin(), prefix.end(), block.begin());
+        std::fill(block.begin() + 40, block.begin() + 52, 'A');
+        const uint64_t size = 52 * 8;
+        block[52] = 0x80;
+        for(int i = 0; i < 8; i++)
+            block[63 - i] = uint8_t(size >> (8*i));
+        return block;
+    }
+
+    Result measure(const Kernel& kernel, const Settings& settings)
+    {
+        alignas(16) auto block = create_block();
+        auto state = sha256_initial_state;
+        double num_hashes = double(settings.num_i012) * 64;
+
+        // Once to get the code and data into the caches
+        kernel.process_chunk(state, block, 0, settings.num_i012, ChunkOptions());
+
+        std::vector<double> cycles;
+        std::vector<double> ns;
+        for(unsigned long i = 0; i < settings.repeats; i++)
+        {
+            auto start_time = std::chrono::steady_clock::now();
+            uint64_t start_tsc = __rdtsc();
+            kernel.process_chunk(state, block, 0, settings.num_i012, ChunkOptions());
+            uint64_t end_tsc = __rdtsc();
+            auto end_time = std::chrono::steady_clock::now();
+
+            cycles.push_back(double(end_tsc - start_tsc) / num_hashes);
+            ns.push_back(std::chrono::duration<double, std::nano>(end_time - start_time).count() / num_hashes);
+        }
+
+        Result output;
+        output.name = kernel.name;
+        mean_and_variance(cycles, output.cycles, output.cycles_variance);
+        mean_and_variance(ns, output.ns, output.ns_variance);
+        output.cycles_min = *std::min_element(cycles.begin(), cycles.end());
+        output.ns_min = *std::min_element(ns.begin(), ns.end());
+        return output;
+    }
+
+    std::string json_string(const std::string& text)
+    {
+        std::string output = "\"";
+        for(char ch : text)
+        {
+            if(ch == '"' || ch == '\\')
+                output += '\\';
+            output += ch;
+        }
+        return output + "\"";
+    }
+
+    // One kernel per line, so that the files of two builds can be
+    // compared with diff
+    std::string format_json(const Settings& settings, const std::vector<Result>& results)
+    {
+        std::string output = "{\n";
+        output += std::format("  \"cpu\": {},\n", json_string(cpu_brand()));
+        output += std::format("  \"hashes\": {},\n", uint64_t(settings.num_i012) * 64);
+        output += std::format("  \"repeats\": {},\n", settings.repeats);
+        output += "  \"kernels\": [\n";
+        for(size_t i = 0; i < results.size(); i++)
+        {
+            auto& result = results[i];
+            output += std::format(
+                "    {{\"name\": {}, \"cycles_per_hash\": {:.3f}, \"cycles_per_hash_min\": {:.3f}, \"cycles_per_hash_variance\": {:.6f}, "
+                "\"ns_per_hash\": {:.4f}, \"ns_per_hash_min\": {:.4f}, \"ns_per_hash_variance\": {:.8f}}}{}\n",
+                json_string(result.name), result.cycles, result.cycles_min, result.cycles_variance,
+                result.ns, result.ns_min, result.ns_variance, i + 1 < results.size() ? "," : "");
+        }
+        output += "  ]\n}\n";
+        return output;
+    }
+
+    unsigned long parse_number(const std::string& str)
+    {
+        std::size_t num_processed = 0;
+        unsigned long value = 0;
+        try
+        {
+            if(!str.empty() && str[0] != '-')
+                value = std::stoul(str, &num_processed, 0);
+        }
+        catch(const std::exception&)
+        {
+        }
+        if(num_processed == 0 || num_processed != str.size())
+            throw std::runtime_error(std::format("Invalid integer '{}'", str));
+        return value;
+    }
+
+    [[noreturn]] void print_help_and_exit(const std::string& program)
+    {
+        print("Usage: {} [-k kernel]... [-n hashes] [-r repeats] [--cpu num] [--json file]\n", program);
+        print("  -k/--kernel name  : Time this kernel, can be given more than once (default is all supported)\n");
+        print("  -n/--hashes num   : Hashes per run, a multiple of 64 up to 2^24 (default 2^22)\n");
+        print("  -r/--repeats num  : Number of runs per kernel (default 10)\n");
+        print("  --cpu num         : Pin the thread to this CPU\n");
+        print("  --json file       : Write the results as JSON to file, or to stdout if file is -\n");
+        print("");
+        std::exit(0);
+    }
+
+    Settings parse_arguments(int argc, char** argv)
+    {
+        Settings output;
+
+        std::list<std::string> args;
+        for(int i = 1; i < argc; i++)
+            args.push_back(argv[i]);
+
+        auto pop = [&](const char* missing) {
+            if(args.empty())
+                throw std::runtime_error(missing);
+            auto value = args.front();
+            args.pop_front();
+            return value;
+        };
+
+        while(!args.empty())
+        {
+            auto arg = pop("");
+            if(arg == "-h" || arg == "--help")
+            {
+                print_help_and_exit(argv[0]);
+            }
+            else if(arg == "-k" || arg == "--kernel")
+            {
+                output.kernels.push_back(pop("Missing kernel name argument"));
+            }
+            else if(arg == "-n" || arg == "--hashes")
+            {
+                auto num = parse_number(pop("Missing number of hashes argument"));
+                if(num < 64 || num % 64 != 0 || num > uint64_t(chunk_size) * 64)
+                    throw std::runtime_error("Number of hashes must be a multiple of 64 up to 2^24");
+                output.num_i012 = uint32_t(num / 64);
+            }
+            else if(arg == "-r" || arg == "--repeats")
+            {
+                output.repeats = parse_number(pop("Missing number of repeats argument"));
+                if(output.repeats < 1)
+                    throw std::runtime_error("Minimum number of repeats is 1");
+            }
+            else if(arg == "--cpu")
+            {
+                output.cpu = int(parse_number(pop("Missing CPU argument")));
+            }
+            else if(arg == "--json")
+            {
+                output.json = pop("Missing JSON file argument");
+            }
+            else
+            {
+                throw std::runtime_error(std::format("Invalid argument '{}'", arg));
+            }
+        }
+        return output;
+    }
+}
+
+void submit_result(const std::array<uint32_t, 4>& result, const std::array<uint8_t, 64>& block)
+{
+    (void)result;
+    (void)block;
+    num_results++;
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        auto settings = parse_arguments(argc, argv);
+
+        std::vector<const Kernel*> kernels;
+        if(settings.kernels.empty())
+        {
+            for(auto& kernel : get_kernels())
+            {
+                if(kernel.supported())
+                    kernels.push_back(&kernel);
+            }
+        }
+        for(auto& name : settings.kernels)
+            kernels.push_back(&select_kernel(name));
+        if(kernels.empty())
+            throw std::runtime_error("This CPU supports neither the SHA extensions nor AVX2");
+
+        if(settings.cpu >= 0 && !pin_thread(settings.cpu))
+            throw std::runtime_error(std::format("Can't pin thread to CPU {}", settings.cpu));
+
+        bool json_stdout = settings.json == "-";
+        if(!json_stdout)
+            print("{}, {} hashes x {} runs\n", cpu_brand(), uint64_t(settings.num_i012) * 64, settings.repeats);
+
+        std::vector<Result> results;
+        for(auto kernel : kernels)
+        {
+            auto result = measure(*kernel, settings);
+            if(!json_stdout)
+            {
+                print("{:<10} {:8.2f} cycles/hash (min {:.2f}, stddev {:.2f})  {:7.3f} ns/hash (min {:.3f}, stddev {:.3f})\n",
+                    result.name, result.cycles, result.cycles_min, std::sqrt(result.cycles_variance),
+                    result.ns, result.ns_min, std::sqrt(result.ns_variance));
+                std::fflush(stdout);
+            }
+            results.push_back(result);
+        }
+
+        if(json_stdout)
+        {
+            print("{}", format_json(settings, results));
+        }
+        else if(!settings.json.empty())
+        {
+            std::ofstream file(settings.json, std::ios::trunc);
+            file << format_json(settings, results);
+            if(!file)
+                throw std::runtime_error(std::format("Can't write '{}'", settings.json));
+        }
+    }
+    catch(const std::exception& e)
+    {
+        print("Error: {}\n", e.what());
+        return 1;
+    }
+    return 0;
+}
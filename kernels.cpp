@@ -0,0 +1,113 @@
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <format>
+#include "cpuid.hpp"
+#include "shallenge.hpp"
+
+uint8_t alphabet[65] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+namespace
+{
+    const std::vector<Kernel> kernel_list {
+        { "sha-2", "SHA extensions, 2 lanes", cpu_has_sha, process_chunk_sha<2> },
+        { "sha-3", "SHA extensions, 3 lanes", cpu_has_sha, process_chunk_sha<3> },
+        { "sha-4", "SHA extensions, 4 lanes", cpu_has_sha, process_chunk_sha<4> },
+        { "avx512", "AVX-512, 16 hashes per vector", cpu_has_avx512, process_chunk_avx512 },
+        { "avx2", "AVX2, eight hashes per vector", cpu_has_avx2, process_chunk_avx2 },
+    };
+
+    // Whether sha256_process_multi should use AVX-512 for groups of 16
+    // messages. With the SHA extensions as well, both are timed once on
+    // the same blocks, since which one is faster depends more on the
+    // CPU (and the hypervisor) than on the number of instructions.
+    bool avx512_multi_is_faster()
+    {
+        if(!cpu_has_avx512())
+            return false;
+        if(!cpu_has_sha())
+            return true;
+
+        const size_t num = 256;
+        std::vector<uint8_t> blocks(64 * num);
+        std::vector<std::array<uint32_t, 8>> states(num, sha256_initial_state);
+        std::vector<uint32_t*> state_ptrs(num);
+        std::vector<const uint8_t*> data_ptrs(num);
+        for(size_t i = 0; i < num; i++)
+        {
+            blocks[64*i] = uint8_t(i);
+            state_ptrs[i] = states[i].data();
+            data_ptrs[i] = &blocks[64*i];
+        }
+
+        // The best of a few runs, the first ones warm up the caches
+        auto time = [&](int lanes, auto process) {
+            double best = 1e9;
+            for(int run = 0; run < 5; run++)
+            {
+                auto start = std::chrono::steady_clock::now();
+                for(size_t i = 0; i < num; i += lanes)
+                    process(&state_ptrs[i], &data_ptrs[i], 64);
+                best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+            return best;
+        };
+        double avx512 = time(16, sha256_process_avx512_multi);
+        double sha = time(4, sha256_process_x86_multi<4>);
+        return avx512 < sha;
+    }
+}
+
+void sha256_process(uint32_t state[8], const uint8_t data[], uint32_t length)
+{
+    static const bool has_sha = cpu_has_sha();
+    if(has_sha)
+        sha256_process_x86(state, data, length);
+    else
+        sha256_process_generic(state, data, length);
+}
+
+void sha256_process_multi(uint32_t* const state[], const uint8_t* const data[], size_t num, uint32_t length)
+{
+    static const bool has_sha = cpu_has_sha();
+    static const bool use_avx512 = avx512_multi_is_faster();
+    size_t i = 0;
+    if(use_avx512)
+    {
+        for(; i + 16 <= num; i += 16)
+            sha256_process_avx512_multi(state + i, data + i, length);
+    }
+    if(has_sha)
+    {
+        for(; i + 4 <= num; i += 4)
+            sha256_process_x86_multi<4>(state + i, data + i, length);
+        for(; i + 2 <= num; i += 2)
+            sha256_process_x86_multi<2>(state + i, data + i, length);
+    }
+    for(; i < num; i++)
+        sha256_process(state[i], data[i], length);
+}
+
+const std::vector<Kernel>& get_kernels()
+{
+    return kernel_list;
+}
+
+const Kernel& select_kernel(const std::string& name)
+{
+    for(auto& kernel : kernel_list)
+    {
+        if(name.empty() && kernel.supported())
+            return kernel;
+        if(name == kernel.name)
+        {
+            if(!kernel.supported())
+                throw std::runtime_error(std::format("Kernel '{}' is not supported by this CPU", name));
+            return kernel;
+        }
+    }
+
+    if(name.empty())
+        throw std::runtime_error("This CPU supports neither the SHA extensions nor AVX2");
+    throw std::runtime_error(std::format("Unknown kernel '{}'", name));
+}
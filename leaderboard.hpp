@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <algorithm>
+
+// A result (the first 128 bits of the hash, as used by submit_result)
+// and the last block of the message that gave it
+struct Candidate
+{
+    std::array<uint32_t, 4> result;
+    std::array<uint8_t, 64> block;
+};
+
+// The best results, at most size of them, best first
+class Leaderboard
+{
+public:
+    explicit Leaderboard(size_t size = 1) :
+        size(size)
+    {
+    }
+
+    // Add the result if it is better than the worst one on a full board.
+    // Returns false if it isn't, or if the block is on the board already.
+    bool add(const std::array<uint32_t, 4>& result, const std::array<uint8_t, 64>& block)
+    {
+        if(full() && result >= candidates.back().result)
+            return false;
+
+        auto it = std::lower_bound(candidates.begin(), candidates.end(), result,
+            [](const Candidate& candidate, const std::array<uint32_t, 4>& value) { return candidate.result < value; });
+        for(auto same = it; same != candidates.end() && same->result == result; ++same)
+        {
+            if(same->block == block)
+                return false;
+        }
+
+        candidates.insert(it, { result, block });
+        if(candidates.size() > size)
+            candidates.pop_back();
+        return true;
+    }
+
+    // A result must be below this to get on the board
+    std::array<uint32_t, 4> cutoff() const
+    {
+        if(!full())
+            return { 0xffffffffU, 0xffffffffU, 0xffffffffU, 0xffffffffU };
+        return candidates.back().result;
+    }
+
+    bool full() const
+    {
+        return candidates.size() >= size;
+    }
+
+    bool empty() const
+    {
+        return candidates.empty();
+    }
+
+    void clear()
+    {
+        candidates.clear();
+    }
+
+    const std::vector<Candidate>& get() const
+    {
+        return candidates;
+    }
+
+private:
+    size_t size;
+    std::vector<Candidate> candidates;
+};
@@ -0,0 +1,269 @@
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+#include <cstring>
+#include <string>
+#include <format>
+#include <stdexcept>
+#include <filesystem>
+#include "net.hpp"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace
+{
+#if defined(_WIN32)
+    using socket_t = SOCKET;
+
+    void close_socket(socket_t socket)
+    {
+        closesocket(socket);
+    }
+
+    void init_sockets()
+    {
+        static const bool initialized = []() {
+            WSADATA data;
+            if(WSAStartup(MAKEWORD(2, 2), &data) != 0)
+                throw std::runtime_error("Can't initialize Winsock");
+            return true;
+        }();
+        (void)initialized;
+    }
+#else
+    using socket_t = int;
+    const socket_t INVALID_SOCKET = -1;
+
+    void close_socket(socket_t socket)
+    {
+        close(socket);
+    }
+
+    void init_sockets()
+    {
+    }
+#endif
+
+    bool is_unix_address(const std::string& address)
+    {
+        return address.starts_with("unix:");
+    }
+
+    sockaddr_un unix_address(const std::string& address)
+    {
+        sockaddr_un output {};
+        output.sun_family = AF_UNIX;
+        auto path = address.substr(5);
+        if(path.empty() || path.size() >= sizeof(output.sun_path))
+            throw std::runtime_error(std::format("Invalid Unix socket path '{}'", path));
+        std::memcpy(output.sun_path, path.data(), path.size());
+        return output;
+    }
+
+    // Look up host:port. The host can be empty when listening, which
+    // means all interfaces.
+    addrinfo* resolve(const std::string& address, bool listen)
+    {
+        auto colon = address.rfind(':');
+        if(colon == std::string::npos)
+            throw std::runtime_error(std::format("Invalid address '{}', expected host:port or unix:path", address));
+        auto host = address.substr(0, colon);
+        auto port = address.substr(colon + 1);
+        if(host.size() >= 2 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+
+        addrinfo hints {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if(listen)
+            hints.ai_flags = AI_PASSIVE;
+
+        addrinfo* output = nullptr;
+        int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &output);
+        if(error != 0)
+            throw std::runtime_error(std::format("Can't resolve '{}': {}", address, gai_strerror(error)));
+        return output;
+    }
+
+    // The requests are small and each one waits for a reply
+    void set_no_delay(socket_t socket)
+    {
+        int value = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&value, sizeof(value));
+    }
+}
+
+Connection::Connection(intptr_t socket) :
+    socket(socket)
+{
+}
+
+Connection::Connection(Connection&& other) :
+    socket(other.socket),
+    buffer(std::move(other.buffer))
+{
+    other.socket = intptr_t(INVALID_SOCKET);
+}
+
+Connection::~Connection()
+{
+    if(socket != intptr_t(INVALID_SOCKET))
+        close_socket(socket_t(socket));
+}
+
+std::string Connection::read_line()
+{
+    for(;;)
+    {
+        auto newline = buffer.find('\n');
+        if(newline != std::string::npos)
+        {
+            auto output = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+            return output;
+        }
+
+        char temp[4096];
+        int num_read = int(recv(socket_t(socket), temp, sizeof(temp), 0));
+        if(num_read <= 0)
+            throw std::runtime_error("Connection closed");
+        buffer.append(temp, size_t(num_read));
+    }
+}
+
+void Connection::write_line(const std::string& line)
+{
+    std::string data = line + "\n";
+    size_t sent = 0;
+    while(sent < data.size())
+    {
+        int num_sent = int(send(socket_t(socket), data.data() + sent, int(data.size() - sent), MSG_NOSIGNAL));
+        if(num_sent <= 0)
+            throw std::runtime_error("Connection closed");
+        sent += size_t(num_sent);
+    }
+}
+
+Listener::Listener(const std::string& address) :
+    socket(intptr_t(INVALID_SOCKET))
+{
+    init_sockets();
+
+    if(is_unix_address(address))
+    {
+        auto addr = unix_address(address);
+
+        // Remove the socket left behind by an earlier run, but nothing
+        // else
+        std::error_code error;
+        if(std::filesystem::is_socket(addr.sun_path, error))
+            std::filesystem::remove(addr.sun_path, error);
+
+        socket_t temp = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if(temp != INVALID_SOCKET)
+        {
+            if(bind(temp, (const sockaddr*)&addr, sizeof(addr)) == 0 && listen(temp, SOMAXCONN) == 0)
+            {
+                socket = intptr_t(temp);
+                unix_path = addr.sun_path;
+            }
+            else
+            {
+                close_socket(temp);
+            }
+        }
+    }
+    else
+    {
+        addrinfo* info = resolve(address, true);
+        for(addrinfo* ptr = info; ptr; ptr = ptr->ai_next)
+        {
+            socket_t temp = ::socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
+            if(temp == INVALID_SOCKET)
+                continue;
+
+            int value = 1;
+            setsockopt(temp, SOL_SOCKET, SO_REUSEADDR, (const char*)&value, sizeof(value));
+            if(bind(temp, ptr->ai_addr, int(ptr->ai_addrlen)) == 0 && listen(temp, SOMAXCONN) == 0)
+            {
+                socket = intptr_t(temp);
+                break;
+            }
+            close_socket(temp);
+        }
+        freeaddrinfo(info);
+    }
+
+    if(socket == intptr_t(INVALID_SOCKET))
+        throw std::runtime_error(std::format("Can't listen on '{}'", address));
+}
+
+Listener::~Listener()
+{
+    close_socket(socket_t(socket));
+    if(!unix_path.empty())
+    {
+        std::error_code error;
+        std::filesystem::remove(unix_path, error);
+    }
+}
+
+Connection Listener::accept()
+{
+    socket_t temp = ::accept(socket_t(socket), nullptr, nullptr);
+    if(temp == INVALID_SOCKET)
+        throw std::runtime_error("Can't accept connection");
+    set_no_delay(temp);
+    return Connection(intptr_t(temp));
+}
+
+Connection connect_to(const std::string& address)
+{
+    init_sockets();
+
+    if(is_unix_address(address))
+    {
+        auto addr = unix_address(address);
+        socket_t temp = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if(temp != INVALID_SOCKET)
+        {
+            if(connect(temp, (const sockaddr*)&addr, sizeof(addr)) == 0)
+                return Connection(intptr_t(temp));
+            close_socket(temp);
+        }
+    }
+    else
+    {
+        addrinfo* info = resolve(address, false);
+        for(addrinfo* ptr = info; ptr; ptr = ptr->ai_next)
+        {
+            socket_t temp = ::socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
+            if(temp == INVALID_SOCKET)
+                continue;
+            if(connect(temp, ptr->ai_addr, int(ptr->ai_addrlen)) == 0)
+            {
+                freeaddrinfo(info);
+                set_no_delay(temp);
+                return Connection(intptr_t(temp));
+            }
+            close_socket(temp);
+        }
+        freeaddrinfo(info);
+    }
+
+    throw std::runtime_error(std::format("Can't connect to '{}'", address));
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// A line based connection over TCP or a Unix socket. Addresses are
+// host:port for TCP and unix:path for Unix sockets.
+class Connection
+{
+public:
+    explicit Connection(intptr_t socket);
+    Connection(Connection&& other);
+    Connection& operator=(Connection&& other) = delete;
+    ~Connection();
+
+    // Read a line without the newline. Throws when the connection is
+    // closed.
+    std::string read_line();
+
+    // Write a line, the newline is added
+    void write_line(const std::string& line);
+
+    // Send a request and read the reply
+    std::string request(const std::string& line)
+    {
+        write_line(line);
+        return read_line();
+    }
+
+private:
+    intptr_t socket;
+    std::string buffer;
+};
+
+class Listener
+{
+public:
+    explicit Listener(const std::string& address);
+    ~Listener();
+
+    // Wait for the next connection
+    Connection accept();
+
+private:
+    intptr_t socket;
+    std::string unix_path;
+};
+
+Connection connect_to(const std::string& address);
@@ -0,0 +1,324 @@
+#include <cstdio>
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include "print.hpp"
+#include "output.hpp"
+
+namespace
+{
+    enum class RecordType
+    {
+        result,
+        best,
+        progress,
+        rate,
+        summary,
+        error,
+        text
+    };
+
+    struct Record
+    {
+        RecordType type;
+        std::chrono::system_clock::time_point time;
+        ResultRecord result;
+        std::string user;
+        std::string seed;
+        bool show_target = false;
+        uint64_t position = 0;
+        RateRecord rate;
+        double seconds = 0;
+        uint64_t num_jobs = 0;
+        uint64_t num_hashes = 0;
+        std::string text;
+    };
+
+    //
+    // Lock free queue with many producers and one consumer. The
+    // producers swap themselves in as the head, and the consumer
+    // follows the next pointers from the tail. The tail is always a
+    // node whose record has been taken (at first a dummy node).
+    //
+    struct Node
+    {
+        std::atomic<Node*> next = nullptr;
+        Record record;
+    };
+
+    Node* queue_tail = new Node;
+    std::atomic<Node*> queue_head = queue_tail;
+
+    // Incremented for each record, the output thread waits on it
+    std::atomic<uint32_t> queue_counter = 0;
+
+    std::atomic<bool> stopping = false;
+    std::thread output_thread;
+    OutputFormat output_format = OutputFormat::text;
+
+    void push(Record&& record)
+    {
+        record.time = std::chrono::system_clock::now();
+        Node* node = new Node;
+        node->record = std::move(record);
+        Node* prev = queue_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+
+        queue_counter.fetch_add(1, std::memory_order_release);
+        queue_counter.notify_one();
+    }
+
+    bool pop(Record& record)
+    {
+        Node* next = queue_tail->next.load(std::memory_order_acquire);
+        if(!next)
+            return false;
+        record = std::move(next->record);
+        delete queue_tail;
+        queue_tail = next;
+        return true;
+    }
+
+    // UTC time as 2024-06-17T12:34:56.789Z
+    std::string format_time(std::chrono::system_clock::time_point time)
+    {
+        auto seconds = std::chrono::system_clock::to_time_t(time);
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000;
+        std::tm tm;
+#if defined(_WIN32)
+        gmtime_s(&tm, &seconds);
+#else
+        gmtime_r(&seconds, &tm);
+#endif
+        return std::format("{:04}-{:02}-{:02}T{:02}:{:02}:{:02}.{:03}Z",
+            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, int(ms));
+    }
+
+    std::string json_string(const std::string& text)
+    {
+        std::string output = "\"";
+        for(char ch : text)
+        {
+            if(ch == '"' || ch == '\\')
+                output += std::format("\\{}", ch);
+            else if((unsigned char)ch < 0x20)
+                output += std::format("\\u{:04x}", int(ch));
+            else
+                output += ch;
+        }
+        return output + "\"";
+    }
+
+    // Seconds as 1d 02:03:04
+    std::string format_duration(double seconds)
+    {
+        if(seconds < 0)
+            return "unknown";
+        uint64_t value = uint64_t(seconds);
+        std::string output;
+        if(value >= 86400)
+            output = std::format("{}d ", value / 86400);
+        return output + std::format("{:02}:{:02}:{:02}", value / 3600 % 24, value / 60 % 60, value % 60);
+    }
+
+    double rate(const Record& record)
+    {
+        double num = double(std::max(UINT64_C(1), record.num_hashes));
+        return num / record.seconds / 1e6;
+    }
+
+    void print_text(const Record& record)
+    {
+        switch(record.type)
+        {
+        case RecordType::result:
+        case RecordType::best:
+            if(record.type == RecordType::best && record.result.rank > 0)
+                print("Best #{}: ", record.result.rank);
+            else if(record.type == RecordType::best)
+                print("Best: ");
+            for(auto word : record.result.hash)
+                print("{:08x} ", word);
+            print("{}\n", record.result.message);
+            break;
+        case RecordType::progress:
+            if(record.show_target)
+                print("{}/{}: ", record.user, record.seed);
+            print("Progress: {}\n", record.position);
+            break;
+        case RecordType::rate:
+        {
+            auto& rate = record.rate;
+            print("Rate: {:.0f}MH/s now, {:.0f}MH/s average, ETA {}\n", rate.rate, rate.average, format_duration(rate.eta));
+            print("Threads:");
+            for(size_t i = 0; i < rate.thread_rate.size(); i++)
+                print(" {:.1f}/{:.1f}", rate.thread_rate[i], rate.thread_average[i]);
+            print(" MH/s\n");
+            break;
+        }
+        case RecordType::summary:
+            print("{:.2f}s {:.0f}MH/s\n", record.seconds, rate(record));
+            break;
+        case RecordType::error:
+            print("Error: {}\n", record.text);
+            break;
+        case RecordType::text:
+            print("{}\n", record.text);
+            break;
+        }
+    }
+
+    void print_json(const Record& record)
+    {
+        const char* types[] = { "result", "best", "progress", "rate", "summary", "error", "message" };
+        std::string line = std::format("{{\"type\":\"{}\",\"time\":\"{}\"", types[int(record.type)], format_time(record.time));
+        switch(record.type)
+        {
+        case RecordType::result:
+        case RecordType::best:
+        {
+            auto& result = record.result;
+            std::string hash;
+            for(auto word : result.hash)
+                hash += std::format("{:08x}", word);
+            if(result.user.empty())
+                line += std::format(",\"hash\":\"{}\",\"message\":{}", hash, json_string(result.message));
+            else
+                line += std::format(",\"user\":{},\"seed\":{},\"hash\":\"{}\",\"message\":{},\"nonce\":{},\"position\":{}",
+                    json_string(result.user), json_string(result.seed), hash, json_string(result.message), json_string(result.nonce), result.position);
+            if(result.thread >= 0)
+                line += std::format(",\"thread\":{}", result.thread);
+            if(result.rank > 0)
+                line += std::format(",\"rank\":{}", result.rank);
+            break;
+        }
+        case RecordType::progress:
+            line += std::format(",\"user\":{},\"seed\":{},\"position\":{}", json_string(record.user), json_string(record.seed), record.position);
+            break;
+        case RecordType::rate:
+        {
+            auto& rate = record.rate;
+            line += std::format(",\"mhs\":{:.1f},\"mhs_average\":{:.1f}", rate.rate, rate.average);
+            if(rate.eta >= 0)
+                line += std::format(",\"eta_seconds\":{:.0f}", rate.eta);
+            line += ",\"threads\":[";
+            for(size_t i = 0; i < rate.thread_rate.size(); i++)
+                line += std::format("{}{{\"mhs\":{:.1f},\"mhs_average\":{:.1f}}}", i == 0 ? "" : ",", rate.thread_rate[i], rate.thread_average[i]);
+            line += "]";
+            break;
+        }
+        case RecordType::summary:
+            line += std::format(",\"seconds\":{:.3f},\"jobs\":{},\"hashes\":{},\"mhs\":{:.1f}",
+                record.seconds, record.num_jobs, record.num_hashes, rate(record));
+            break;
+        case RecordType::error:
+        case RecordType::text:
+            line += std::format(",\"text\":{}", json_string(record.text));
+            break;
+        }
+        print("{}}}\n", line);
+    }
+
+    void output_func()
+    {
+        Record record;
+        for(;;)
+        {
+            uint32_t counter = queue_counter.load(std::memory_order_acquire);
+            bool any = false;
+            while(pop(record))
+            {
+                if(output_format == OutputFormat::json)
+                    print_json(record);
+                else
+                    print_text(record);
+                any = true;
+            }
+            if(any)
+                std::fflush(stdout);
+            else if(stopping)
+                break;
+            else
+                queue_counter.wait(counter, std::memory_order_acquire);
+        }
+    }
+}
+
+void start_output(OutputFormat format)
+{
+    output_format = format;
+    output_thread = std::thread(output_func);
+}
+
+void stop_output()
+{
+    if(!output_thread.joinable())
+        return;
+    stopping = true;
+    queue_counter.fetch_add(1, std::memory_order_release);
+    queue_counter.notify_one();
+    output_thread.join();
+}
+
+void output_result(const ResultRecord& result)
+{
+    Record record;
+    record.type = RecordType::result;
+    record.result = result;
+    push(std::move(record));
+}
+
+void output_best(const ResultRecord& result)
+{
+    Record record;
+    record.type = RecordType::best;
+    record.result = result;
+    push(std::move(record));
+}
+
+void output_progress(const std::string& user, const std::string& seed, bool show_target, uint64_t position)
+{
+    Record record;
+    record.type = RecordType::progress;
+    record.user = user;
+    record.seed = seed;
+    record.show_target = show_target;
+    record.position = position;
+    push(std::move(record));
+}
+
+void output_rate(const RateRecord& rate)
+{
+    Record record;
+    record.type = RecordType::rate;
+    record.rate = rate;
+    push(std::move(record));
+}
+
+void output_summary(double seconds, uint64_t num_jobs, uint64_t num_hashes)
+{
+    Record record;
+    record.type = RecordType::summary;
+    record.seconds = seconds;
+    record.num_jobs = num_jobs;
+    record.num_hashes = num_hashes;
+    push(std::move(record));
+}
+
+void output_error(const std::string& text)
+{
+    Record record;
+    record.type = RecordType::error;
+    record.text = text;
+    push(std::move(record));
+}
+
+void output_text(const std::string& text)
+{
+    Record record;
+    record.type = RecordType::text;
+    record.text = text;
+    push(std::move(record));
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <string>
+#include <vector>
+#include <format>
+
+//
+// All output after the arguments are parsed goes through a queue to an
+// output thread, so that the threads running the jobs never wait for
+// stdout. The records are printed as text or as JSON Lines.
+//
+
+enum class OutputFormat
+{
+    text,
+    json
+};
+
+// A hash and the message it is the hash of. thread is the index of the
+// thread that found it, or -1 if it didn't come from a thread (e.g.
+// from a checkpoint or a worker). rank is the place on the leaderboard
+// at the end, starting at 1, or 0 if there is no leaderboard. The
+// results of --verify only have the hash and message, and user is empty.
+struct ResultRecord
+{
+    std::array<uint32_t, 8> hash;
+    std::string user;
+    std::string seed;
+    std::string message;
+    std::string nonce;
+    uint64_t position;
+    int thread;
+    int rank;
+};
+
+// The hash rate in MH/s, since the last report and as a moving average,
+// in total and for each thread. eta is the seconds left, or negative if
+// not known.
+struct RateRecord
+{
+    double rate;
+    double average;
+    double eta;
+    std::vector<double> thread_rate;
+    std::vector<double> thread_average;
+};
+
+void start_output(OutputFormat format);
+
+// Print everything in the queue and stop the output thread
+void stop_output();
+
+// A new best result, and the best results at the end
+void output_result(const ResultRecord& record);
+void output_best(const ResultRecord& record);
+
+// All jobs of the target before position are done
+void output_progress(const std::string& user, const std::string& seed, bool show_target, uint64_t position);
+
+// The current rate, see telemetry.cpp
+void output_rate(const RateRecord& record);
+
+// The final rate. num_hashes also counts the hashes of jobs that were
+// cut short, which are not in num_jobs.
+void output_summary(double seconds, uint64_t num_jobs, uint64_t num_hashes);
+
+void output_error(const std::string& text);
+
+// Anything else
+void output_text(const std::string& text);
+
+template<class... Args>
+void output_message(std::format_string<Args...> fmt, Args&&... args)
+{
+    output_text(std::vformat(fmt.get(), std::make_format_args(args...)));
+}
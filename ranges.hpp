@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <utility>
+#include <vector>
+
+// A set of job numbers, stored as sorted, non-overlapping and
+// non-adjacent [begin, end) ranges
+class RangeSet
+{
+public:
+    void add(uint64_t begin, uint64_t end)
+    {
+        if(begin >= end)
+            return;
+
+        // Merge with the ranges that overlap or touch the new range
+        auto it = ranges.upper_bound(begin);
+        if(it != ranges.begin())
+        {
+            auto prev = std::prev(it);
+            if(prev->second >= begin)
+            {
+                begin = prev->first;
+                end = std::max(end, prev->second);
+                ranges.erase(prev);
+            }
+        }
+        while(it != ranges.end() && it->first <= end)
+        {
+            end = std::max(end, it->second);
+            it = ranges.erase(it);
+        }
+        ranges[begin] = end;
+    }
+
+    // The parts of [begin, end) that are not in the set
+    std::vector<std::pair<uint64_t, uint64_t>> missing(uint64_t begin, uint64_t end) const
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> output;
+        for(auto& [first, last] : ranges)
+        {
+            if(last <= begin)
+                continue;
+            if(first >= end)
+                break;
+            if(first > begin)
+                output.emplace_back(begin, first);
+            begin = std::max(begin, last);
+        }
+        if(begin < end)
+            output.emplace_back(begin, end);
+        return output;
+    }
+
+    // The number of values in [begin, end) that are in the set
+    uint64_t count(uint64_t begin, uint64_t end) const
+    {
+        uint64_t output = end - begin;
+        for(auto& [first, last] : missing(begin, end))
+            output -= last - first;
+        return output;
+    }
+
+    // The parts of [begin, end) that are in the set
+    std::vector<std::pair<uint64_t, uint64_t>> present(uint64_t begin, uint64_t end) const
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> output;
+        for(auto& [first, last] : missing(begin, end))
+        {
+            if(first > begin)
+                output.emplace_back(begin, first);
+            begin = last;
+        }
+        if(begin < end)
+            output.emplace_back(begin, end);
+        return output;
+    }
+
+    // The first number >= begin that is not in the set
+    uint64_t first_missing(uint64_t begin) const
+    {
+        auto it = ranges.upper_bound(begin);
+        if(it != ranges.begin() && std::prev(it)->second > begin)
+            return std::prev(it)->second;
+        return begin;
+    }
+
+    const std::map<uint64_t, uint64_t>& get() const
+    {
+        return ranges;
+    }
+
+private:
+    std::map<uint64_t, uint64_t> ranges;
+};
@@ -0,0 +1,839 @@
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <set>
+#include <optional>
+#include <utility>
+#include <algorithm>
+#include <bit>
+#include <condition_variable>
+#include <stdexcept>
+#include <format>
+#include "searcher.hpp"
+#include "leaderboard.hpp"
+#include "topology.hpp"
+
+namespace
+{
+    // A target and the state of its search
+    struct TargetState
+    {
+        SearchTarget spec;
+        size_t index = 0;
+
+        // The blocks before the last block of the message, the state
+        // after them, and the last block
+        std::vector<uint8_t> message_head;
+        std::array<uint32_t, 8> midstate = sha256_initial_state;
+        std::array<uint8_t, 64> block { 0 };
+
+        // The best results. Protected by best_mutex.
+        Leaderboard best;
+
+        // The first 64 bits of the worst result on a full leaderboard of
+        // the target or of any thread, or max_result_head before that.
+        // Results above it are dropped without taking a lock.
+        std::atomic<uint64_t> threshold = UINT64_MAX;
+
+        // The jobs that have been completed. Protected by done_mutex.
+        RangeSet done_jobs;
+
+        // The jobs to run as [begin, end) ranges, the index of the
+        // first job of each range, and the index of the next job to
+        // hand out. Protected by job_mutex.
+        std::vector<std::pair<uint64_t, uint64_t>> pending_jobs;
+        std::vector<uint64_t> pending_offsets;
+        uint64_t num_pending_jobs = 0;
+        uint64_t next_index = 0;
+    };
+
+    // A job that is being run, and how much of it is taken and done. job
+    // is the position in the shard of the target (see SearchTarget).
+    struct ActiveJob
+    {
+        TargetState* target;
+        uint64_t job;
+        std::atomic<uint32_t> next_i012 = 0;
+        std::atomic<uint32_t> done_i012 = 0;
+    };
+
+    // The jobs are run in slices of i012 values. A thread that has no
+    // job of its own takes slices from the jobs of other threads, and
+    // near the end of the search the slices are smaller, so that all
+    // threads are busy until the last job is done.
+    //
+    // In the tail, each thread takes slices in proportion to its speed
+    // compared to the fastest thread, so that the slow cores of a
+    // hybrid CPU don't hold up the end of the search.
+    const uint32_t slice_size = chunk_size / 16;
+    const uint32_t tail_slice_size = chunk_size / 256;
+    const uint32_t min_slice_size = 64;
+}
+
+struct SearchState
+{
+    SearchOptions options;
+
+    // The targets don't change while the threads run
+    std::deque<TargetState> targets;
+
+    // The highest first 64 bits of a result that is kept, and of a
+    // result that can be below the difficulty
+    uint64_t max_result_head = 0xffffffffU;
+    uint64_t difficulty_head = 0;
+
+    // The nonce is at bytes 52-nonce_length to 51 of the last block.
+    // The characters before byte 48 are the job number.
+    unsigned nonce_length = min_nonce_length;
+    std::string alphabet;
+
+    // Given to the kernels. cancel points to cancelled, and alphabet to
+    // the alphabet above.
+    ChunkOptions chunk_options;
+
+    std::mutex best_mutex;
+    std::mutex done_mutex;
+    std::mutex job_mutex;
+
+    // Set by stop and cancel. The threads finish the job they are
+    // running and then stop, unless the chunks are cancelled.
+    std::atomic<bool> stopped = false;
+    std::atomic<bool> cancelled = false;
+
+    // Set when a hash below the difficulty is found. The target and the
+    // last block of its message are protected by best_mutex, and
+    // hit_target is only set once the block is there.
+    std::atomic<bool> hit_found = false;
+    std::optional<size_t> hit_target;
+    std::array<uint8_t, 64> hit_block { 0 };
+
+    // The jobs that have slices left, protected by job_mutex
+    std::vector<std::shared_ptr<ActiveJob>> active_jobs;
+    unsigned long num_threads_running = 0;
+    std::atomic<bool> in_tail = false;
+
+    // The hashes per second of the fastest thread
+    std::atomic<double> fastest_rate = 0;
+};
+
+struct SearcherPool
+{
+    std::vector<std::thread> threads;
+    std::vector<ThreadCounter> counters;
+    std::vector<int> unpinned_cpus;
+
+    // The search the threads run. A new generation starts them, and
+    // num_running counts the threads that are not done with it yet.
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable finished_cv;
+    SearchState* search = nullptr;
+    uint64_t generation = 0;
+    unsigned long num_running = 0;
+    unsigned long num_started = 0;
+    bool stopping = false;
+
+    explicit SearcherPool(unsigned long num_threads) :
+        counters(num_threads)
+    {
+    }
+};
+
+namespace
+{
+    // The search and target of the job that the thread is running, which
+    // is where submit_result puts the results
+    thread_local SearchState* current_search = nullptr;
+    thread_local TargetState* current_target = nullptr;
+
+    // The index of the thread in the pool, -1 for other threads
+    thread_local int thread_index = -1;
+
+    // The best results the thread has found in the slice it is running.
+    // They are merged into the leaderboard of the target when the slice
+    // is done, so that the kernels never wait for a lock.
+    thread_local Leaderboard thread_results;
+
+    // Create the prefix, which is username/seed/ padded with /'s up to 40
+    // bytes. If username/seed/ is longer than that, it is padded up to 40
+    // bytes into a later block (104, 168, ...). This way, the 12 characters
+    // after the prefix always end up at position 40-51 in the last block.
+    // A longer nonce starts earlier, and the prefix is shorter by as much.
+    std::vector<uint8_t> create_padded_prefix(
+        const std::string& username,
+        const std::string& seed,
+        unsigned nonce_length)
+    {
+        std::string temp = username;
+        temp += "/";
+        temp += seed;
+        temp += "/";
+
+        size_t size = 52 - nonce_length;
+        while(size < temp.size())
+            size += 64;
+
+        std::vector<uint8_t> output(temp.begin(), temp.end());
+        output.resize(size, '/');
+        return output;
+    }
+
+    // The last block of the message. Only the last 52-nonce_length bytes
+    // of the prefix are in this block.
+    std::array<uint8_t, 64> create_block(
+        const std::vector<uint8_t>& prefix,
+        unsigned nonce_length)
+    {
+        std::array<uint8_t, 64> block { 0 };
+
+        // Put the prefix at the beginning
+        std::copy(prefix.end() - (52 - nonce_length), prefix.end(), block.begin());
+
+        // Set end padding and size
+        const uint64_t size = (prefix.size() + nonce_length) * 8;
+        block[52] = 0x80;
+        for(int i = 0; i < 8; i++)
+            block[63 - i] = uint8_t(size >> (8*i));
+        return block;
+    }
+
+    // Set up the blocks of the message. The blocks before the last block
+    // are the same for all hashes, so they are only processed once.
+    void init_target(TargetState& target, const SearchState& search)
+    {
+        auto prefix = create_padded_prefix(target.spec.user, target.spec.seed, search.nonce_length);
+        target.block = create_block(prefix, search.nonce_length);
+        target.message_head.assign(prefix.begin(), prefix.end() - (52 - search.nonce_length));
+        target.midstate = sha256_initial_state;
+        sha256_process(target.midstate.data(), target.message_head.data(), uint32_t(target.message_head.size()));
+        target.best = Leaderboard(search.options.top);
+        target.threshold = search.max_result_head;
+        target.done_jobs = target.spec.done;
+    }
+
+    // The last block of the message with the nonce
+    std::array<uint8_t, 64> nonce_block(const SearchState& search, const TargetState& target, const std::string& nonce)
+    {
+        if(nonce.size() != search.nonce_length)
+            throw std::runtime_error(std::format("Invalid nonce '{}', must be {} characters", nonce, search.nonce_length));
+        if(nonce.find_first_not_of(search.alphabet) != std::string::npos)
+            throw std::runtime_error(std::format("Invalid characters in '{}'", nonce));
+        auto block = target.block;
+        std::copy(nonce.begin(), nonce.end(), block.begin() + 52 - search.nonce_length);
+        return block;
+    }
+
+    // Hash the block again to get the whole hash
+    SearchResult make_result(const SearchState& search, const TargetState& target, const std::array<uint8_t, 64>& block, int thread)
+    {
+        SearchResult result;
+        result.target = target.index;
+        result.hash = target.midstate;
+        sha256_process(result.hash.data(), block.data(), 64);
+
+        result.message.assign(target.message_head.begin(), target.message_head.end());
+        result.message.append(block.begin(), block.begin() + 52);
+        result.nonce.assign(block.begin() + 52 - search.nonce_length, block.begin() + 52);
+
+        // The job is the nonce without the last 4 characters
+        result.position = 0;
+        for(int i = 52 - int(search.nonce_length); i < 48; i++)
+            result.position = 64*result.position + search.alphabet.find(char(block[i]));
+
+        result.thread = thread;
+        return result;
+    }
+
+    // The first 64 bits of a result, as used for the threshold
+    uint64_t result_head(const std::array<uint32_t, 4>& result)
+    {
+        return (uint64_t(result[0]) << 32) | result[1];
+    }
+
+    // Lower the threshold of the target unless another thread has already
+    // lowered it further
+    void publish_threshold(TargetState& target, uint64_t head)
+    {
+        uint64_t current = target.threshold.load(std::memory_order_relaxed);
+        while(head < current && !target.threshold.compare_exchange_weak(current, head, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // Put the result on the leaderboard of the target if it is good
+    // enough, and report it if it is the new best or the hash below the
+    // difficulty
+    void add_result(SearchState& search, TargetState& target, const std::array<uint32_t, 4>& result, const std::array<uint8_t, 64>& block, int thread, bool is_hit = false)
+    {
+        bool is_best = false;
+        if(result_head(result) <= search.max_result_head)
+        {
+            bool added;
+            uint64_t cutoff;
+            {
+                std::lock_guard lock(search.best_mutex);
+                added = target.best.add(result, block);
+                is_best = added && target.best.get().front().block == block;
+                cutoff = target.best.full() ? result_head(target.best.cutoff()) : UINT64_MAX;
+            }
+            if(added)
+                publish_threshold(target, cutoff);
+        }
+        if((is_best || is_hit) && search.options.on_result)
+            search.options.on_result(make_result(search, target, block, thread));
+    }
+
+    // Check the whole hash against the difficulty. The first hash below it
+    // cancels the running chunks of all threads, and is put on the
+    // leaderboard and reported here, so that it is reported once even if
+    // it is not the new best.
+    void check_difficulty(SearchState& search, TargetState& target, const std::array<uint8_t, 64>& block, int thread)
+    {
+        std::array<uint32_t, 8> hash = target.midstate;
+        sha256_process(hash.data(), block.data(), 64);
+        if(hash >= *search.options.difficulty)
+            return;
+        if(search.hit_found.exchange(true))
+            return;
+
+        search.stopped = true;
+        search.cancelled = true;
+        {
+            std::lock_guard lock(search.best_mutex);
+            search.hit_target = target.index;
+            search.hit_block = block;
+        }
+        if(search.options.on_hit)
+            search.options.on_hit(make_result(search, target, block, thread));
+        add_result(search, target, { hash[0], hash[1], hash[4], hash[5] }, block, thread, true);
+    }
+
+    // Merge the results of the thread into the leaderboard of the target
+    void flush_thread_results(SearchState& search, TargetState& target)
+    {
+        for(auto& candidate : thread_results.get())
+            add_result(search, target, candidate.result, candidate.block, thread_index);
+        thread_results.clear();
+    }
+
+    // Get the job number for an index into the pending jobs
+    uint64_t get_job(const TargetState& target, uint64_t index)
+    {
+        auto& offsets = target.pending_offsets;
+        auto it = std::upper_bound(offsets.begin(), offsets.end(), index) - 1;
+        return target.pending_jobs[it - offsets.begin()].first + (index - *it);
+    }
+
+    // Hand out the next job, or a part of a job that another thread is
+    // running when there are no new jobs left. Returns null when there is
+    // nothing left to do.
+    std::shared_ptr<ActiveJob> next_job(SearchState& search)
+    {
+        std::lock_guard lock(search.job_mutex);
+
+        // Forget the jobs that have no slices left
+        std::erase_if(search.active_jobs, [](auto& job) { return job->next_i012 >= chunk_size; });
+        if(search.stopped)
+            return nullptr;
+
+        // Take a new job from the target that is furthest behind its
+        // share of the jobs
+        TargetState* target = nullptr;
+        uint64_t num_left = 0;
+        for(auto& candidate : search.targets)
+        {
+            if(candidate.next_index >= candidate.num_pending_jobs)
+                continue;
+            num_left += candidate.num_pending_jobs - candidate.next_index;
+            if(!target || double(candidate.next_index) / candidate.spec.weight < double(target->next_index) / target->spec.weight)
+                target = &candidate;
+        }
+
+        // Use smaller slices when there aren't enough new jobs left for
+        // all threads
+        search.in_tail = num_left < search.num_threads_running;
+
+        if(target)
+        {
+            uint64_t index = target->next_index++;
+            auto job = std::make_shared<ActiveJob>();
+            job->target = target;
+            job->job = get_job(*target, index);
+            search.active_jobs.push_back(job);
+
+            auto interval = search.options.progress_interval;
+            if(search.options.on_progress && interval > 0 && index > 0 && index % interval == 0)
+            {
+                // Report the first job that is not done, since the jobs
+                // before it may still be running on other threads
+                std::lock_guard done_lock(search.done_mutex);
+                uint64_t position = target->done_jobs.first_missing(target->pending_jobs.front().first);
+                search.options.on_progress(target->index, position);
+            }
+            return job;
+        }
+
+        // Help with the job that has the most slices left
+        std::shared_ptr<ActiveJob> output;
+        for(auto& job : search.active_jobs)
+        {
+            if(!output || job->next_i012 < output->next_i012)
+                output = job;
+        }
+        return output;
+    }
+
+    // The kernel for the type of core the thread is on now
+    const Kernel& current_kernel(const SearchState& search)
+    {
+        auto& kernels = search.options.core_kernels;
+        if(!kernels.empty())
+        {
+            size_t type = size_t(current_core_type());
+            if(type < kernels.size() && kernels[type])
+                return *kernels[type];
+        }
+        return *search.options.kernel;
+    }
+
+    // The size of the next slice for a thread with the given speed
+    uint32_t next_slice_size(const SearchState& search, double rate)
+    {
+        if(!search.in_tail)
+            return slice_size;
+        double fastest = search.fastest_rate.load(std::memory_order_relaxed);
+        if(rate <= 0 || rate >= fastest)
+            return tail_slice_size;
+        return std::max(min_slice_size, uint32_t(tail_slice_size * (rate / fastest)));
+    }
+
+    // Run jobs of the search until there are none left, and count the
+    // hashes
+    void run_jobs(SearchState& search, ThreadCounter& hashes)
+    {
+        current_search = &search;
+        thread_results = Leaderboard(search.options.top);
+
+        // A moving average of the hashes per second of this thread
+        double rate = 0;
+
+        alignas(16) std::array<uint8_t, 64> block;
+
+        // Run the loop as long as there are jobs
+        while(auto job = next_job(search))
+        {
+            TargetState* target = job->target;
+
+            // Write counter as string of all but the last 4 characters
+            // of the nonce (backwards)
+            block = target->block;
+            uint64_t counter = job->job * target->spec.num_shards + target->spec.shard;
+            for(int i = 47; i >= 52 - int(search.nonce_length); i--)
+            {
+                block[i] = search.chunk_options.alphabet[counter % 64U];
+                counter /= 64U;
+            }
+
+            // Run slices of the job until all are taken. This doesn't
+            // check stopped, so a job that was started is always
+            // finished, unless the search is cancelled.
+            current_target = target;
+            for(;;)
+            {
+                uint32_t size = next_slice_size(search, rate);
+                uint32_t begin = job->next_i012.fetch_add(size);
+                if(begin >= chunk_size)
+                    break;
+                uint32_t end = std::min(begin + size, chunk_size);
+
+                auto start_time = std::chrono::steady_clock::now();
+                current_kernel(search).process_chunk(target->midstate, block, begin, end, search.chunk_options);
+                std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start_time;
+                flush_thread_results(search, *target);
+
+                // The slice may not be finished, and then neither is the job
+                if(search.cancelled)
+                    break;
+                hashes.add(uint64_t(end - begin) * 64);
+
+                if(duration.count() > 0)
+                {
+                    double slice_rate = (end - begin) * 64.0 / duration.count();
+                    rate = rate == 0 ? slice_rate : 0.75 * rate + 0.25 * slice_rate;
+                    double fastest = search.fastest_rate.load(std::memory_order_relaxed);
+                    while(rate > fastest && !search.fastest_rate.compare_exchange_weak(fastest, rate, std::memory_order_relaxed))
+                    {
+                    }
+                }
+
+                if(job->done_i012.fetch_add(end - begin) + (end - begin) == chunk_size)
+                {
+                    std::lock_guard lock(search.done_mutex);
+                    target->done_jobs.add(job->job, job->job + 1);
+                }
+            }
+        }
+
+        current_search = nullptr;
+        current_target = nullptr;
+    }
+
+    void pool_thread(SearcherPool& pool, int index, int cpu)
+    {
+        thread_index = index;
+        bool pinned = cpu < 0 || pin_thread(cpu);
+
+        std::unique_lock lock(pool.mutex);
+        if(!pinned)
+            pool.unpinned_cpus.push_back(cpu);
+        pool.num_started++;
+        pool.finished_cv.notify_all();
+
+        uint64_t generation = 0;
+        for(;;)
+        {
+            pool.start_cv.wait(lock, [&]() { return pool.stopping || pool.generation != generation; });
+            if(pool.stopping)
+                return;
+            generation = pool.generation;
+            auto search = pool.search;
+
+            lock.unlock();
+            run_jobs(*search, pool.counters[index]);
+            lock.lock();
+
+            if(--pool.num_running == 0)
+                pool.finished_cv.notify_all();
+        }
+    }
+}
+
+// Called from the kernels. This only updates the results of the thread,
+// see flush_thread_results.
+void submit_result(const std::array<uint32_t, 4>& result, const std::array<uint8_t, 64>& block)
+{
+    SearchState* search = current_search;
+    TargetState* target = current_target;
+    if(!search || !target)
+        return;
+
+    if(search->options.difficulty && result_head(result) <= search->difficulty_head)
+        check_difficulty(*search, *target, block, thread_index);
+
+    if(result_head(result) > target->threshold.load(std::memory_order_relaxed))
+        return;
+    if(!thread_results.add(result, block))
+        return;
+
+    // The leaderboard of the target can't be worse than that of a
+    // single thread
+    if(thread_results.full())
+        publish_threshold(*target, result_head(thread_results.cutoff()));
+}
+
+void validate_string(const std::string& string)
+{
+    std::set<char> valid_chars;
+    for(uint8_t* ptr = alphabet; ptr != alphabet+64; ++ptr)
+        valid_chars.insert(*ptr);
+
+    for(auto ch : string)
+    {
+        if(!valid_chars.contains(ch))
+            throw std::runtime_error(std::format("Invalid characters in '{}'", string));
+    }
+}
+
+void validate_alphabet(const std::string& alphabet)
+{
+    std::set<char> chars(alphabet.begin(), alphabet.end());
+    if(alphabet.size() != 64 || chars.size() != 64)
+        throw std::runtime_error(std::format("Alphabet '{}' must be 64 different characters", alphabet));
+    for(auto ch : alphabet)
+    {
+        if(ch <= ' ' || ch > '~')
+            throw std::runtime_error(std::format("Alphabet '{}' must be printable characters other than space", alphabet));
+    }
+}
+
+uint64_t max_jobs(unsigned nonce_length)
+{
+    return UINT64_C(1) << (6 * (nonce_length - 4));
+}
+
+std::array<uint8_t, 64> create_search_block(const std::string& user, const std::string& seed, unsigned nonce_length)
+{
+    return create_block(create_padded_prefix(user, seed, nonce_length), nonce_length);
+}
+
+Search::Search(std::vector<SearchTarget> targets, SearchOptions options) :
+    state(std::make_unique<SearchState>())
+{
+    if(targets.empty())
+        throw std::runtime_error("No targets to search");
+    if(options.top < 1 || options.top > 10000)
+        throw std::runtime_error("Leaderboard size must be from 1 to 10000");
+    if(options.min_zero_bits < 16 || options.min_zero_bits > 64)
+        throw std::runtime_error("Minimum number of zero bits must be from 16 to 64");
+    if(options.nonce_length < min_nonce_length || options.nonce_length > max_nonce_length)
+        throw std::runtime_error(std::format("Nonce length must be from {} to {}", min_nonce_length, max_nonce_length));
+    if(!options.alphabet.empty())
+        validate_alphabet(options.alphabet);
+
+    state->options = std::move(options);
+    auto& opts = state->options;
+    state->max_result_head = opts.min_zero_bits == 64 ? 0 : UINT64_MAX >> opts.min_zero_bits;
+
+    // The kernels must also submit the results that could be below the
+    // difficulty
+    unsigned long filter_bits = opts.min_zero_bits;
+    if(opts.difficulty)
+    {
+        if(*opts.difficulty == std::array<uint32_t, 8> { 0 })
+            throw std::runtime_error("Target must be above 0");
+        auto limit = *opts.difficulty;
+        for(int i = 7; i >= 0 && limit[i]-- == 0; i--)
+        {
+        }
+        state->difficulty_head = (uint64_t(limit[0]) << 32) | limit[1];
+
+        unsigned long zero_bits = 0;
+        for(auto word : limit)
+        {
+            zero_bits += unsigned(std::countl_zero(word));
+            if(word != 0)
+                break;
+        }
+        filter_bits = std::min(filter_bits, zero_bits);
+    }
+    if(filter_bits >= 32)
+        state->chunk_options.result_mask = 0xffffffffU;
+    else
+        state->chunk_options.result_mask = filter_bits == 0 ? 0 : ~(0xffffffffU >> filter_bits);
+    state->chunk_options.cancel = &state->cancelled;
+
+    state->nonce_length = opts.nonce_length;
+    state->alphabet = opts.alphabet.empty() ? std::string(alphabet, alphabet + 64) : opts.alphabet;
+    state->chunk_options.alphabet = reinterpret_cast<const uint8_t*>(state->alphabet.data());
+
+    for(auto& spec : targets)
+    {
+        validate_string(spec.user);
+        validate_string(spec.seed);
+        if(spec.num_shards < 1 || spec.shard >= spec.num_shards)
+            throw std::runtime_error(std::format("Invalid shard {}/{} for {}/{}", spec.shard, spec.num_shards, spec.user, spec.seed));
+        uint64_t num_positions = max_jobs(opts.nonce_length) / spec.num_shards + (spec.shard < max_jobs(opts.nonce_length) % spec.num_shards);
+        if(spec.start >= spec.end || spec.end > num_positions)
+            throw std::runtime_error(std::format("Invalid range {} to {} for {}/{}, must be start < end <= {}", spec.start, spec.end, spec.user, spec.seed, num_positions));
+        if(spec.weight < 1)
+            throw std::runtime_error(std::format("Invalid weight for {}/{}, minimum is 1", spec.user, spec.seed));
+
+        auto& target = state->targets.emplace_back();
+        target.spec = std::move(spec);
+        target.index = state->targets.size() - 1;
+        init_target(target, *state);
+
+        // The results from before are not reported again
+        for(auto& nonce : target.spec.best)
+        {
+            auto block = nonce_block(*state, target, nonce);
+            std::array<uint32_t, 8> hash = target.midstate;
+            sha256_process(hash.data(), block.data(), 64);
+            std::array<uint32_t, 4> result = { hash[0], hash[1], hash[4], hash[5] };
+            if(result_head(result) <= state->max_result_head)
+                target.best.add(result, block);
+        }
+        if(target.best.full())
+            target.threshold = std::min(target.threshold.load(), result_head(target.best.cutoff()));
+    }
+}
+
+Search::~Search() = default;
+
+size_t Search::num_targets() const
+{
+    return state->targets.size();
+}
+
+const SearchTarget& Search::target(size_t index) const
+{
+    return state->targets.at(index).spec;
+}
+
+RangeSet Search::done_jobs(size_t index) const
+{
+    std::lock_guard lock(state->done_mutex);
+    return state->targets.at(index).done_jobs;
+}
+
+void Search::add_done_jobs(size_t index, uint64_t begin, uint64_t end)
+{
+    std::lock_guard lock(state->done_mutex);
+    state->targets.at(index).done_jobs.add(begin, end);
+}
+
+std::vector<SearchResult> Search::best(size_t index) const
+{
+    auto& target = state->targets.at(index);
+    std::vector<Candidate> candidates;
+    {
+        std::lock_guard lock(state->best_mutex);
+        candidates = target.best.get();
+    }
+
+    std::vector<SearchResult> output;
+    for(auto& candidate : candidates)
+        output.push_back(make_result(*state, target, candidate.block, -1));
+    return output;
+}
+
+void Search::add_nonce(size_t index, const std::string& nonce)
+{
+    auto& target = state->targets.at(index);
+    auto block = nonce_block(*state, target, nonce);
+
+    std::array<uint32_t, 8> hash = target.midstate;
+    sha256_process(hash.data(), block.data(), 64);
+    if(state->options.difficulty)
+        check_difficulty(*state, target, block, -1);
+    add_result(*state, target, { hash[0], hash[1], hash[4], hash[5] }, block, -1);
+}
+
+std::optional<SearchResult> Search::hit() const
+{
+    // hit_found is set before the block, so only hit_target says that
+    // the block is there
+    if(!state->hit_found)
+        return std::nullopt;
+
+    size_t index;
+    std::array<uint8_t, 64> block;
+    {
+        std::lock_guard lock(state->best_mutex);
+        if(!state->hit_target)
+            return std::nullopt;
+        index = *state->hit_target;
+        block = state->hit_block;
+    }
+    return make_result(*state, state->targets[index], block, -1);
+}
+
+void Search::stop()
+{
+    state->stopped = true;
+}
+
+void Search::cancel()
+{
+    state->stopped = true;
+    state->cancelled = true;
+}
+
+Searcher::Searcher(unsigned long num_threads, const std::vector<int>& cpus) :
+    pool(std::make_unique<SearcherPool>(std::max(1UL, num_threads)))
+{
+    num_threads = std::max(1UL, num_threads);
+    for(unsigned long i = 0; i < num_threads; i++)
+    {
+        int cpu = i < cpus.size() ? cpus[i] : -1;
+        pool->threads.push_back(std::thread(pool_thread, std::ref(*pool), int(i), cpu));
+    }
+
+    // Wait until the threads are pinned, so that unpinned_cpus is complete
+    std::unique_lock lock(pool->mutex);
+    pool->finished_cv.wait(lock, [&]() { return pool->num_started == num_threads; });
+}
+
+Searcher::~Searcher()
+{
+    {
+        std::lock_guard lock(pool->mutex);
+        pool->stopping = true;
+        pool->start_cv.notify_all();
+    }
+    for(auto& thread : pool->threads)
+        thread.join();
+}
+
+unsigned long Searcher::num_threads() const
+{
+    return (unsigned long)pool->threads.size();
+}
+
+const std::vector<ThreadCounter>& Searcher::counters() const
+{
+    return pool->counters;
+}
+
+std::vector<int> Searcher::unpinned_cpus() const
+{
+    std::lock_guard lock(pool->mutex);
+    return pool->unpinned_cpus;
+}
+
+void Searcher::start(Search& search)
+{
+    auto& state = *search.state;
+    if(!state.options.kernel)
+        throw std::runtime_error("No kernel set for the search");
+
+    std::lock_guard lock(pool->mutex);
+    if(pool->num_running > 0)
+        throw std::runtime_error("The searcher is already running a search");
+
+    // The jobs that are not done yet. A search that was stopped can be
+    // started again and continues where it was.
+    {
+        std::lock_guard job_lock(state.job_mutex);
+        std::lock_guard done_lock(state.done_mutex);
+        for(auto& target : state.targets)
+        {
+            target.pending_jobs = target.done_jobs.missing(target.spec.start, target.spec.end);
+            target.pending_offsets.clear();
+            target.num_pending_jobs = 0;
+            target.next_index = 0;
+            for(auto& [begin, end] : target.pending_jobs)
+            {
+                target.pending_offsets.push_back(target.num_pending_jobs);
+                target.num_pending_jobs += end - begin;
+            }
+        }
+        state.active_jobs.clear();
+        state.num_threads_running = num_threads();
+        state.in_tail = false;
+        if(!state.hit_found)
+        {
+            state.stopped = false;
+            state.cancelled = false;
+        }
+    }
+
+    pool->search = &state;
+    pool->generation++;
+    pool->num_running = num_threads();
+    pool->start_cv.notify_all();
+}
+
+void Searcher::wait()
+{
+    std::unique_lock lock(pool->mutex);
+    pool->finished_cv.wait(lock, [&]() { return pool->num_running == 0; });
+}
+
+bool Searcher::wait_for(std::chrono::milliseconds timeout)
+{
+    std::unique_lock lock(pool->mutex);
+    return pool->finished_cv.wait_for(lock, timeout, [&]() { return pool->num_running == 0; });
+}
+
+void Searcher::run(Search& search)
+{
+    start(search);
+    wait();
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ranges.hpp"
+#include "shallenge.hpp"
+#include "telemetry.hpp"
+
+//
+// The search as a library
+//
+// A Search holds the targets, the jobs that are done and the best
+// results of one search. A Searcher owns a pool of threads that runs one
+// Search at a time, and the threads are kept for the next one. The
+// results and progress are reported through callbacks, and the state of
+// a Search can be read and changed from other threads while it runs.
+//
+
+// The jobs are numbered from 0 to max_position. Each job is 2^24 hashes
+// and sets the first 8 characters of the nonce.
+const uint64_t max_position = UINT64_C(1) << (8*6);
+
+// The nonce can be longer than 12 characters. The characters in front
+// take the place of the / padding of the prefix, and each one gives 64
+// times as many jobs. The job number must fit in 64 bits.
+const unsigned min_nonce_length = 12;
+const unsigned max_nonce_length = 14;
+
+// The number of jobs with a nonce of this length, max_position for 12
+uint64_t max_jobs(unsigned nonce_length);
+
+// A username and seed to search from start to end, which must be at
+// most max_jobs of the nonce length of the search. The jobs in done are
+// skipped, and the nonces in best (e.g. from an earlier search) are put
+// on the leaderboard without being reported again. When several targets
+// are searched at the same time, a target with weight 2 gets twice as
+// many jobs as one with weight 1.
+//
+// With num_shards above 1, the target is shard number shard of the
+// jobs, which are dealt out to the shards in turn. start, end, done
+// and the progress are then positions in the shard, and position p is
+// job p*num_shards + shard. The position of a result is still the job.
+struct SearchTarget
+{
+    std::string user;
+    std::string seed;
+    uint64_t start = 0;
+    uint64_t end = max_position;
+    unsigned long weight = 1;
+    uint64_t shard = 0;
+    uint64_t num_shards = 1;
+    RangeSet done;
+    std::vector<std::string> best;
+};
+
+// A hash and the message it is the hash of. target is the index of the
+// target in the search. thread is the index of the thread in the pool
+// that found it, or -1 if it was added with add_nonce.
+struct SearchResult
+{
+    size_t target;
+    std::array<uint32_t, 8> hash;
+    std::string message;
+    std::string nonce;
+    uint64_t position;
+    int thread;
+};
+
+struct SearchOptions
+{
+    // The kernel to run, see select_kernel and autotune_kernel
+    const Kernel* kernel = nullptr;
+
+    // The kernel for each core type on hybrid CPUs (see CpuInfo). The
+    // threads look up the type of the core they are on for each slice
+    // of a job, and run kernel on the types that have none here.
+    std::vector<const Kernel*> core_kernels;
+
+    // The number of best results kept for each target, and the number
+    // of zero bits a result must start with to be kept (16 to 64)
+    size_t top = 1;
+    unsigned long min_zero_bits = 32;
+
+    // Stop at the first hash below this
+    std::optional<std::array<uint32_t, 8>> difficulty;
+
+    // The number of characters in the nonce, and the 64 different
+    // characters they are taken from. The default is base64.
+    unsigned nonce_length = min_nonce_length;
+    std::string alphabet;
+
+    // Called with each new best result of a target, with the first hash
+    // below the difficulty, and every progress_interval jobs of a target
+    // with the first job that is not done. The hash below the difficulty
+    // is also passed to on_result once, after on_hit, even if it is not
+    // the new best. They are called from the threads of the pool (or of
+    // add_nonce), so they must be quick and thread safe.
+    std::function<void(const SearchResult&)> on_result;
+    std::function<void(const SearchResult&)> on_hit;
+    std::function<void(size_t target, uint64_t position)> on_progress;
+    uint64_t progress_interval = 65536;
+};
+
+struct SearchState;
+
+class Search
+{
+public:
+    Search(std::vector<SearchTarget> targets, SearchOptions options);
+    ~Search();
+
+    Search(const Search&) = delete;
+    Search& operator=(const Search&) = delete;
+
+    size_t num_targets() const;
+
+    // The target as given to the constructor, with the jobs that were
+    // done before the search
+    const SearchTarget& target(size_t index) const;
+
+    // The jobs of the target that are done now
+    RangeSet done_jobs(size_t index) const;
+
+    // Mark jobs as done that were run somewhere else. They are not
+    // handed out if the search hasn't got to them yet.
+    void add_done_jobs(size_t index, uint64_t begin, uint64_t end);
+
+    // The best results of the target, best first
+    std::vector<SearchResult> best(size_t index) const;
+
+    // Check a nonce that was found somewhere else (e.g. a checkpoint or
+    // another machine) and keep it if it is good enough
+    void add_nonce(size_t index, const std::string& nonce);
+
+    // The first hash below the difficulty, if it has been found. This
+    // can be called from any thread.
+    std::optional<SearchResult> hit() const;
+
+    // Don't start any more jobs. The jobs that are running are finished.
+    void stop();
+
+    // Stop, and leave the running jobs within 64 hashes. The jobs that
+    // are cut short are not done.
+    void cancel();
+
+private:
+    friend class Searcher;
+    std::unique_ptr<SearchState> state;
+};
+
+struct SearcherPool;
+
+class Searcher
+{
+public:
+    // Start the threads. Each thread is pinned to the CPU at its index
+    // in cpus, unless cpus is empty. The threads wait for a search and
+    // are stopped when the Searcher is destroyed, which must not happen
+    // while a search is running.
+    explicit Searcher(unsigned long num_threads, const std::vector<int>& cpus = {});
+    ~Searcher();
+
+    Searcher(const Searcher&) = delete;
+    Searcher& operator=(const Searcher&) = delete;
+
+    unsigned long num_threads() const;
+
+    // The hashes done by each thread, over all searches
+    const std::vector<ThreadCounter>& counters() const;
+
+    // The CPUs that threads could not be pinned to
+    std::vector<int> unpinned_cpus() const;
+
+    // Run the search on the threads. Only one search runs at a time, and
+    // it must be waited for before the next one is started or the search
+    // is destroyed. A search that was stopped can be started again.
+    void start(Search& search);
+
+    // Wait until all threads are done with the search. wait_for returns
+    // false if that takes longer than the timeout.
+    void wait();
+    bool wait_for(std::chrono::milliseconds timeout);
+
+    // Start the search and wait for it
+    void run(Search& search);
+
+private:
+    std::unique_ptr<SearcherPool> pool;
+};
+
+// The username and seed may only contain characters of the base64
+// alphabet. Throws std::runtime_error if they don't.
+void validate_string(const std::string& string);
+
+// The alphabet must be 64 different printable characters other than
+// space. Throws std::runtime_error if it isn't.
+void validate_alphabet(const std::string& alphabet);
+
+// The last block of the message for a username and seed, with room for
+// a nonce of the given length at the end
+std::array<uint8_t, 64> create_search_block(const std::string& user, const std::string& seed, unsigned nonce_length = min_nonce_length);
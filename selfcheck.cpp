@@ -0,0 +1,260 @@
+#include <cstdint>
+#include <cstdio>
+#include <array>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include "print.hpp"
+#include "shallenge.hpp"
+#include "ranges.hpp"
+#include "leaderboard.hpp"
+#include "checkpoint.hpp"
+
+//
+// Checks of the kernels and of the parts of the program that don't need
+// a search, run with make check. Every supported kernel must submit the
+// same results as plain SHA-256 on the same blocks, also after a first
+// block and with another alphabet. Prints the failed checks and returns
+// 1 if there are any.
+//
+
+namespace
+{
+    int num_failed = 0;
+
+    // A result and its block, which compare as a pair
+    using Submitted = std::pair<std::array<uint32_t, 4>, std::array<uint8_t, 64>>;
+
+    // What the kernel that is running submitted
+    std::vector<Submitted> submitted;
+
+    void check(bool condition, const std::string& what)
+    {
+        if(!condition)
+        {
+            print("FAILED: {}\n", what);
+            num_failed++;
+        }
+    }
+
+    // A message of prefix_length bytes and 12 nonce bytes, which must
+    // end at byte 52 of the last block. Returns the last block, and the
+    // state before it in state.
+    std::array<uint8_t, 64> create_block(size_t prefix_length, std::array<uint32_t, 8>& state)
+    {
+        std::vector<uint8_t> message(prefix_length + 12, '/');
+        for(size_t i = 0; i < prefix_length; i++)
+            message[i] = uint8_t('a' + i % 26);
+
+        size_t head = message.size() - 52;
+        state = sha256_initial_state;
+        sha256_process_generic(state.data(), message.data(), uint32_t(head));
+
+        std::array<uint8_t, 64> block { 0 };
+        std::copy(message.begin() + head, message.end(), block.begin());
+        const uint64_t size = message.size() * 8;
+        block[52] = 0x80;
+        for(int i = 0; i < 8; i++)
+            block[63 - i] = uint8_t(size >> (8*i));
+        return block;
+    }
+
+    // The results the kernels should submit for i012 from begin to end
+    std::vector<Submitted> reference_results(
+        const std::array<uint32_t, 8>& state, const std::array<uint8_t, 64>& input_data,
+        uint32_t i012_begin, uint32_t i012_end, const ChunkOptions& options)
+    {
+        std::vector<Submitted> output;
+        auto block = input_data;
+        for(uint32_t i012 = i012_begin; i012 < i012_end; i012++)
+        {
+            block[48] = options.alphabet[(i012>>12) & 63];
+            block[49] = options.alphabet[(i012>>6) & 63];
+            block[50] = options.alphabet[(i012>>0) & 63];
+            for(int i3 = 0; i3 < 64; i3++)
+            {
+                block[51] = options.alphabet[i3];
+                auto hash = state;
+                sha256_process_generic(hash.data(), block.data(), 64);
+                if((hash[0] & options.result_mask) == 0)
+                    output.push_back({ { hash[0], hash[1], hash[4], hash[5] }, block });
+            }
+        }
+        std::sort(output.begin(), output.end());
+        return output;
+    }
+
+    void check_kernels()
+    {
+        const uint8_t reversed[65] = "/+9876543210zyxwvutsrqponmlkjihgfedcbaZYXWVUTSRQPONMLKJIHGFEDCBA";
+
+        struct Case
+        {
+            const char* name;
+            size_t prefix_length;
+            const uint8_t* alphabet;
+            uint32_t i012_begin;
+            uint32_t i012_end;
+        };
+        const Case cases[] = {
+            { "one block", 40, alphabet, 0, 256 },
+            { "end of the chunk", 40, alphabet, chunk_size - 256, chunk_size },
+            { "after a first block", 104, alphabet, 4096, 4352 },
+            { "other alphabet", 40, reversed, 1000, 1256 },
+        };
+
+        int num_kernels = 0;
+        for(auto& test : cases)
+        {
+            std::array<uint32_t, 8> state;
+            auto block = create_block(test.prefix_length, state);
+            ChunkOptions options;
+            options.result_mask = 0xff000000U;
+            options.alphabet = test.alphabet;
+            auto expected = reference_results(state, block, test.i012_begin, test.i012_end, options);
+            check(!expected.empty(), std::format("reference results for {}", test.name));
+
+            for(auto& kernel : get_kernels())
+            {
+                if(!kernel.supported())
+                    continue;
+                submitted.clear();
+                kernel.process_chunk(state, block, test.i012_begin, test.i012_end, options);
+                std::sort(submitted.begin(), submitted.end());
+                check(submitted == expected, std::format("{} kernel, {}: {} results, expected {}", kernel.name, test.name, submitted.size(), expected.size()));
+                num_kernels++;
+            }
+        }
+        check(num_kernels > 0, "no supported kernels");
+    }
+
+    void check_sha256_multi()
+    {
+        // Enough messages for the groups of 16, 4 and 2 and a single one
+        const size_t num = 23;
+        const uint32_t length = 128;
+        std::vector<std::vector<uint8_t>> messages(num, std::vector<uint8_t>(length));
+        std::vector<std::array<uint32_t, 8>> states(num, sha256_initial_state);
+        std::vector<uint32_t*> state_pointers;
+        std::vector<const uint8_t*> data_pointers;
+        for(size_t i = 0; i < num; i++)
+        {
+            for(uint32_t j = 0; j < length; j++)
+                messages[i][j] = uint8_t(i * 31 + j * 7);
+            state_pointers.push_back(states[i].data());
+            data_pointers.push_back(messages[i].data());
+        }
+        sha256_process_multi(state_pointers.data(), data_pointers.data(), num, length);
+
+        for(size_t i = 0; i < num; i++)
+        {
+            auto expected = sha256_initial_state;
+            sha256_process_generic(expected.data(), messages[i].data(), length);
+            check(states[i] == expected, std::format("sha256_process_multi, message {}", i));
+        }
+    }
+
+    void check_ranges()
+    {
+        using Ranges = std::vector<std::pair<uint64_t, uint64_t>>;
+
+        RangeSet set;
+        set.add(10, 20);
+        set.add(30, 40);
+        set.add(20, 25);
+        set.add(5, 5);
+        check(set.present(0, 100) == Ranges { { 10, 25 }, { 30, 40 } }, "RangeSet merges adjacent ranges");
+        check(set.missing(0, 100) == Ranges { { 0, 10 }, { 25, 30 }, { 40, 100 } }, "RangeSet::missing");
+        check(set.missing(12, 35) == Ranges { { 25, 30 } }, "RangeSet::missing inside ranges");
+        check(set.count(15, 35) == 15, "RangeSet::count");
+
+        set.add(22, 32);
+        check(set.present(0, 100) == Ranges { { 10, 40 } }, "RangeSet merges overlapping ranges");
+        check(set.present(15, 18) == Ranges { { 15, 18 } }, "RangeSet::present inside a range");
+    }
+
+    void check_leaderboard()
+    {
+        auto candidate = [](uint32_t head, uint8_t id) {
+            Candidate output { { head, 0, 0, 0 }, { 0 } };
+            output.block[0] = id;
+            return output;
+        };
+
+        Leaderboard board(3);
+        check(board.add(candidate(50, 1).result, candidate(50, 1).block), "Leaderboard takes a result");
+        check(!board.add(candidate(50, 1).result, candidate(50, 1).block), "Leaderboard drops the same block");
+        check(board.add(candidate(50, 2).result, candidate(50, 2).block), "Leaderboard takes the same result of another block");
+        check(board.add(candidate(10, 3).result, candidate(10, 3).block), "Leaderboard takes a better result");
+        check(board.full(), "Leaderboard::full");
+        check(!board.add(candidate(60, 4).result, candidate(60, 4).block), "Leaderboard drops a worse result when full");
+        check(board.add(candidate(20, 5).result, candidate(20, 5).block), "Leaderboard takes a better result when full");
+
+        std::vector<uint32_t> heads;
+        for(auto& entry : board.get())
+            heads.push_back(entry.result[0]);
+        check(heads == std::vector<uint32_t> { 10, 20, 50 }, "Leaderboard keeps the best results, best first");
+        check(board.cutoff()[0] == 50, "Leaderboard::cutoff");
+    }
+
+    void check_checkpoint()
+    {
+        Checkpoint checkpoint;
+        checkpoint.user = "user";
+        checkpoint.seed = "seed";
+        checkpoint.nonce_length = 13;
+        checkpoint.alphabet = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-_";
+        checkpoint.shard = 3;
+        checkpoint.num_shards = 16;
+        checkpoint.done.add(0, 1200);
+        checkpoint.done.add(1208, 1210);
+        checkpoint.best.push_back({ { 0x00000000U, 0xe69407ddU, 0x8dd914b8U, 0xddfe27f3U }, "AAAAAABljV0WA" });
+        checkpoint.best.push_back({ { 0x00000000U, 0x757ae4c1U, 0x2db70008U, 0x6fd25356U }, "AAAAAACLGNW/A" });
+
+        auto path = (std::filesystem::temp_directory_path() / "shallenge-selfcheck.txt").string();
+        write_checkpoint(path, checkpoint);
+        auto read = read_checkpoint(path);
+        std::filesystem::remove(path);
+
+        check(read.user == checkpoint.user && read.seed == checkpoint.seed, "checkpoint user and seed");
+        check(read.nonce_length == checkpoint.nonce_length && read.alphabet == checkpoint.alphabet, "checkpoint nonce length and alphabet");
+        check(read.shard == checkpoint.shard && read.num_shards == checkpoint.num_shards, "checkpoint shard");
+        check(read.done.present(0, 2000) == checkpoint.done.present(0, 2000), "checkpoint done jobs");
+        bool same_best = read.best.size() == checkpoint.best.size();
+        for(size_t i = 0; same_best && i < read.best.size(); i++)
+            same_best = read.best[i].result == checkpoint.best[i].result && read.best[i].nonce == checkpoint.best[i].nonce;
+        check(same_best, "checkpoint best results");
+    }
+}
+
+void submit_result(const std::array<uint32_t, 4>& result, const std::array<uint8_t, 64>& block)
+{
+    submitted.push_back({ result, block });
+}
+
+int main()
+{
+    try
+    {
+        check_kernels();
+        check_sha256_multi();
+        check_ranges();
+        check_leaderboard();
+        check_checkpoint();
+    }
+    catch(std::exception& e)
+    {
+        print("FAILED: {}\n", e.what());
+        num_failed++;
+    }
+
+    if(num_failed > 0)
+    {
+        print("{} checks failed\n", num_failed);
+        return 1;
+    }
+    print("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "kernel-sha.hpp"
+
+//
+// Multi-buffer SHA-256 with the SHA extensions
+//
+// Hashing one message at a time leaves the SHA unit waiting for the
+// result of each sha256rnds2. Here the rounds of L messages of the same
+// length are interleaved with rounds4, like the lanes of the kernels,
+// so that their latencies overlap. This is used to check many messages
+// with their own blocks (see verify.cpp), where the kernels don't apply.
+//
+// The rounds are the same as in sha256_process_x86.
+//
+template<int L>
+void sha256_process_x86_multi(uint32_t* const state[], const uint8_t* const data[], uint32_t length)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i STATE0[L], STATE1[L], MSG0[L], MSG1[L], MSG2[L], MSG3[L];
+
+    /* Load initial values */
+    for(int l = 0; l < L; l++)
+    {
+        __m128i TMP = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &state[l][0]), 0xB1);   /* CDAB */
+        STATE1[l] = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &state[l][4]), 0x1B);     /* EFGH */
+        STATE0[l] = _mm_alignr_epi8(TMP, STATE1[l], 8);                                          /* ABEF */
+        STATE1[l] = _mm_blend_epi16(STATE1[l], TMP, 0xF0);                                       /* CDGH */
+    }
+
+    for(uint32_t offset = 0; offset + 64 <= length; offset += 64)
+    {
+        /* Save current state */
+        __m128i ABEF_SAVE[L], CDGH_SAVE[L];
+        for(int l = 0; l < L; l++)
+        {
+            ABEF_SAVE[l] = STATE0[l];
+            CDGH_SAVE[l] = STATE1[l];
+        }
+
+        for(int l = 0; l < L; l++)
+        {
+            MSG0[l] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data[l] + offset + 0)), MASK);
+            MSG1[l] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data[l] + offset + 16)), MASK);
+            MSG2[l] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data[l] + offset + 32)), MASK);
+            MSG3[l] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data[l] + offset + 48)), MASK);
+        }
+
+        /* Rounds 0-15 */
+        rounds4<L, false, false>(STATE0, STATE1, MSG3, MSG0, MSG1, _mm_set_epi64x(0xE9B5DBA5B5C0FBCFULL, 0x71374491428A2F98ULL));
+        rounds4<L, true, false>(STATE0, STATE1, MSG0, MSG1, MSG2, _mm_set_epi64x(0xAB1C5ED5923F82A4ULL, 0x59F111F13956C25BULL));
+        rounds4<L, true, false>(STATE0, STATE1, MSG1, MSG2, MSG3, _mm_set_epi64x(0x550C7DC3243185BEULL, 0x12835B01D807AA98ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG2, MSG3, MSG0, _mm_set_epi64x(0xC19BF1749BDC06A7ULL, 0x80DEB1FE72BE5D74ULL));
+
+        /* Rounds 16-63 */
+        rounds4<L, true, true>(STATE0, STATE1, MSG3, MSG0, MSG1, _mm_set_epi64x(0x240CA1CC0FC19DC6ULL, 0xEFBE4786E49B69C1ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG0, MSG1, MSG2, _mm_set_epi64x(0x76F988DA5CB0A9DCULL, 0x4A7484AA2DE92C6FULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG1, MSG2, MSG3, _mm_set_epi64x(0xBF597FC7B00327C8ULL, 0xA831C66D983E5152ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG2, MSG3, MSG0, _mm_set_epi64x(0x1429296706CA6351ULL, 0xD5A79147C6E00BF3ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG3, MSG0, MSG1, _mm_set_epi64x(0x53380D134D2C6DFCULL, 0x2E1B213827B70A85ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG0, MSG1, MSG2, _mm_set_epi64x(0x92722C8581C2C92EULL, 0x766A0ABB650A7354ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG1, MSG2, MSG3, _mm_set_epi64x(0xC76C51A3C24B8B70ULL, 0xA81A664BA2BFE8A1ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG2, MSG3, MSG0, _mm_set_epi64x(0x106AA070F40E3585ULL, 0xD6990624D192E819ULL));
+        rounds4<L, true, true>(STATE0, STATE1, MSG3, MSG0, MSG1, _mm_set_epi64x(0x34B0BCB52748774CULL, 0x1E376C0819A4C116ULL));
+        rounds4<L, false, true>(STATE0, STATE1, MSG0, MSG1, MSG2, _mm_set_epi64x(0x682E6FF35B9CCA4FULL, 0x4ED8AA4A391C0CB3ULL));
+        rounds4<L, false, true>(STATE0, STATE1, MSG1, MSG2, MSG3, _mm_set_epi64x(0x8CC7020884C87814ULL, 0x78A5636F748F82EEULL));
+        rounds4<L, false, false>(STATE0, STATE1, MSG2, MSG3, MSG0, _mm_set_epi64x(0xC67178F2BEF9A3F7ULL, 0xA4506CEB90BEFFFAULL));
+
+        /* Combine state  */
+        for(int l = 0; l < L; l++)
+        {
+            STATE0[l] = _mm_add_epi32(STATE0[l], ABEF_SAVE[l]);
+            STATE1[l] = _mm_add_epi32(STATE1[l], CDGH_SAVE[l]);
+        }
+    }
+
+    /* Save state */
+    for(int l = 0; l < L; l++)
+    {
+        __m128i TMP = _mm_shuffle_epi32(STATE0[l], 0x1B);          /* FEBA */
+        STATE1[l] = _mm_shuffle_epi32(STATE1[l], 0xB1);            /* DCHG */
+        _mm_storeu_si128((__m128i*) &state[l][0], _mm_blend_epi16(TMP, STATE1[l], 0xF0));   /* DCBA */
+        _mm_storeu_si128((__m128i*) &state[l][4], _mm_alignr_epi8(STATE1[l], TMP, 8));      /* HGFE */
+    }
+}
+
+template void sha256_process_x86_multi<2>(uint32_t* const[], const uint8_t* const[], uint32_t);
+template void sha256_process_x86_multi<4>(uint32_t* const[], const uint8_t* const[], uint32_t);
@@ -3,539 +3,783 @@
 #define _CRT_SECURE_NO_WARNINGS
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
-#include <immintrin.h>
 #include <Windows.h>
-#else
-#include <x86intrin.h>
 #endif
 #include <cstdio>
 #include <cstring>
+#include <csignal>
 #include <thread>
 #include <vector>
+#include <memory>
 #include <array>
 #include <atomic>
 #include <mutex>
 #include <string>
 #include <list>
 #include <set>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <fstream>
 #include <utility>
 #include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <filesystem>
 #include "print.hpp"
-
-void sha256_process_x86(uint32_t state[8], const uint8_t data[], uint32_t length);
+#include "cpuid.hpp"
+#include "shallenge.hpp"
+#include "searcher.hpp"
+#include "checkpoint.hpp"
+#include "net.hpp"
+#include "topology.hpp"
+#include "output.hpp"
+#include "telemetry.hpp"
+#include "verify.hpp"
 
 namespace
 {
-    const uint64_t max_position = UINT64_C(1) << (8*6);
-    std::atomic<uint64_t> job_counter = 0;
-    std::array<uint32_t, 4> best_result { 0xffffffffU, 0xffffffffU, 0xffffffffU, 0xffffffffU };
-    std::mutex best_mutex;
-    std::mutex print_mutex;
-    uint8_t alphabet[65] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    // Set by SIGINT/SIGTERM. The threads finish the job they are running
+    // and then stop.
+    std::atomic<bool> stop_requested = false;
+
+    // How often the main thread looks at stop_requested, the time and
+    // the checkpoint while the threads are running
+    const auto poll_interval = std::chrono::milliseconds(100);
 }
 
-void print_result(const std::array<uint8_t, 64>& block)
+ResultRecord make_result_record(const std::string& user, const std::string& seed, const SearchResult& result)
 {
-    std::array<uint32_t, 8> state {
-        0x6a09e667U, 0xbb67ae85U, 0x3c6ef372U, 0xa54ff53aU,
-        0x510e527fU, 0x9b05688cU, 0x1f83d9abU, 0x5be0cd19U
-    };
-    sha256_process_x86(state.data(), block.data(), 64);
+    ResultRecord record;
+    record.hash = result.hash;
+    record.user = user;
+    record.seed = seed;
+    record.message = result.message;
+    record.nonce = result.nonce;
+    record.position = result.position;
+    record.thread = result.thread;
+    record.rank = 0;
+    return record;
+}
 
-    std::lock_guard lock(print_mutex);
-    for(int i = 0; i < 8; i++)
-        print("{:08x} ", state[i]);
+std::string format_difficulty(const std::array<uint32_t, 8>& value)
+{
+    std::string output;
+    for(auto word : value)
+        output += std::format("{:08x}", word);
+    return output;
+}
+
+struct Settings
+{
+    unsigned long num_threads = std::max(1U, std::thread::hardware_concurrency());
+    uint64_t start = 0;
+    uint64_t end = max_position;
+    std::string kernel;
+    bool retune = false;
+    unsigned long duration = 0;
+    std::string checkpoint;
+    unsigned long checkpoint_interval = 60;
+    bool resume = false;
+    std::string coordinator;
+    std::string worker;
+    uint64_t lease_size = 1024;
+    unsigned long lease_time = 60;
+    std::string batch;
+    AffinityPolicy affinity = AffinityPolicy::none;
+    OutputFormat format = OutputFormat::text;
+    std::vector<int> numa_nodes;
+    unsigned long report_interval = 60;
+    std::string metrics;
+    unsigned long top = 1;
+    unsigned long min_zero_bits = 32;
+    std::optional<std::array<uint32_t, 8>> difficulty;
+    unsigned nonce_length = min_nonce_length;
+    std::string alphabet;
+    uint64_t shard = 0;
+    uint64_t num_shards = 1;
+    std::string verify;
+    std::string user;
+    std::string seed;
+};
 
-    for(int i = 0; i < 52; i++)
-        print("{:c}", block[i]);
-    print("\n");
+// With --shard i/N, the jobs are dealt out to N shards in turn and this
+// process runs shard i, so that several machines can split a search
+// without a coordinator. The targets and the checkpoint count positions
+// in the shard (see SearchTarget), while the positions that are printed
+// and set with -s and -e are jobs.
+
+// The first position in the shard whose job is at or after job
+uint64_t shard_position(const Settings& settings, uint64_t job)
+{
+    if(job <= settings.shard)
+        return 0;
+    return (job - settings.shard + settings.num_shards - 1) / settings.num_shards;
 }
 
-// Check the result to see if it is better than the current best.
-// Only the first 128 bits of the hash are checked.
-inline void check_result(__m128i state0, const std::array<uint8_t, 64>& block)
+uint64_t shard_job(const Settings& settings, uint64_t position)
 {
-    alignas(__m128i) uint32_t temp[4];
+    return position * settings.num_shards + settings.shard;
+}
 
-    _mm_store_si128((__m128i*)temp, state0);
+// " (shard i/N)", or empty without --shard
+std::string shard_name(const Settings& settings)
+{
+    if(settings.num_shards == 1)
+        return "";
+    return std::format(" (shard {}/{})", settings.shard, settings.num_shards);
+}
 
-    // Ignore all results where the first 32 bits are not 0
-    if(temp[3] != 0)
-        return;
+// " (n jobs of shard i/N)" for a range of positions, since the range of
+// jobs it spans also has the jobs of the other shards. Empty without
+// --shard.
+std::string shard_jobs_name(const Settings& settings, uint64_t begin, uint64_t end)
+{
+    if(settings.num_shards == 1)
+        return "";
+    return std::format(" ({} job{} of shard {}/{})", end - begin, end - begin == 1 ? "" : "s", settings.shard, settings.num_shards);
+}
+
+// The kernel of the search, and on hybrid CPUs the kernel for each type
+// of core and the name of the type
+struct Kernels
+{
+    const Kernel* kernel = nullptr;
+    std::vector<const Kernel*> core_kernels;
+    std::vector<std::string> core_names;
+};
+
+// "the sha-4 kernel", or with a kernel per core type "the sha-4 kernel
+// on the P-cores and the sha-2 kernel on the E-cores"
+std::string describe_kernels(const Kernels& kernels)
+{
+    if(kernels.core_kernels.empty())
+        return std::format("the {} kernel", kernels.kernel->name);
+
+    std::string output;
+    for(size_t i = 0; i < kernels.core_kernels.size(); i++)
+    {
+        if(!kernels.core_kernels[i])
+            continue;
+        if(!output.empty())
+            output += " and ";
+        output += std::format("the {} kernel on the {}", kernels.core_kernels[i]->name, kernels.core_names[i]);
+    }
+    return output;
+}
+
+// Find the fastest kernel for each type of core on hybrid CPUs, with the
+// threads that the search will run on that type. With --affinity these
+// are the pinned threads, otherwise as many threads as there are CPUs of
+// the type. Types without threads get no kernel. Returns nothing on
+// CPUs with one type of core.
+Kernels autotune_core_types(
+    const std::array<uint8_t, 64>& block, const std::vector<CpuInfo>& topology,
+    const std::vector<int>& pinned_cpus, const Settings& settings)
+{
+    Kernels output;
+    int num_types = num_core_types(topology);
+    if(num_types < 2)
+        return output;
+
+    for(int type = 0; type < num_types; type++)
+    {
+        std::vector<int> cpus;
+        for(auto& cpu : topology)
+        {
+            if(cpu.core_type == type)
+                cpus.push_back(cpu.id);
+        }
+
+        unsigned long num_threads = std::min<unsigned long>(settings.num_threads, (unsigned long)cpus.size());
+        if(!pinned_cpus.empty())
+        {
+            num_threads = 0;
+            for(int cpu : pinned_cpus)
+            {
+                if(std::find(cpus.begin(), cpus.end(), cpu) != cpus.end())
+                    num_threads++;
+            }
+        }
+
+        auto name = core_type_name(type, num_types);
+        const Kernel* kernel = num_threads == 0 ? nullptr : &autotune_kernel(block, num_threads, settings.retune, cpus, name);
+        if(kernel && !output.kernel)
+            output.kernel = kernel;
+        output.core_kernels.push_back(kernel);
+        output.core_names.push_back(name);
+    }
+    return output;
+}
+
+// The options for a search of the targets, which print the new best
+// results, the hash below the target and the progress
+SearchOptions make_search_options(const Settings& settings, const Kernels& kernels, const std::vector<SearchTarget>& targets)
+{
+    SearchOptions options;
+    options.kernel = kernels.kernel;
+    options.core_kernels = kernels.core_kernels;
+    options.top = settings.top;
+    options.min_zero_bits = settings.min_zero_bits;
+    options.difficulty = settings.difficulty;
+    options.nonce_length = settings.nonce_length;
+    options.alphabet = settings.alphabet;
 
-    auto result = std::to_array({temp[3], temp[2], temp[1], temp[0]});
+    auto names = std::make_shared<std::vector<std::pair<std::string, std::string>>>();
+    for(auto& target : targets)
+        names->emplace_back(target.user, target.seed);
+    bool show_target = targets.size() > 1;
+
+    options.on_result = [names](const SearchResult& result) {
+        auto& [user, seed] = (*names)[result.target];
+        output_result(make_result_record(user, seed, result));
+    };
+    options.on_hit = [](const SearchResult&) {
+        output_message("Found a hash below the target");
+    };
+    options.on_progress = [names, show_target, shard = settings.shard, num_shards = settings.num_shards](size_t target, uint64_t position) {
+        auto& [user, seed] = (*names)[target];
+        output_progress(user, seed, show_target, position * num_shards + shard);
+    };
+    return options;
+}
+
+// The checkpoint is for the first (and only) target
+void save_checkpoint(const Settings& settings, const Search& search)
+{
+    auto& target = search.target(0);
+    Checkpoint checkpoint;
+    checkpoint.user = target.user;
+    checkpoint.seed = target.seed;
+    checkpoint.nonce_length = settings.nonce_length;
+    checkpoint.alphabet = settings.alphabet;
+    checkpoint.shard = settings.shard;
+    checkpoint.num_shards = settings.num_shards;
+    checkpoint.done = search.done_jobs(0);
+    for(auto& result : search.best(0))
+        checkpoint.best.push_back({ { result.hash[0], result.hash[1], result.hash[4], result.hash[5] }, result.nonce });
+    write_checkpoint(settings.checkpoint, checkpoint);
+}
 
-    std::lock_guard lock(best_mutex);
-    if(result >= best_result)
+// Continue from the checkpoint file if it exists. The nonces of the best
+// results go in the best of the target, so they are checked again but
+// not reported as new results.
+void load_checkpoint(const Settings& settings, SearchTarget& target)
+{
+    if(!std::filesystem::exists(settings.checkpoint))
         return;
 
-    best_result = result;
-    print_result(block);
+    auto checkpoint = read_checkpoint(settings.checkpoint);
+    if(checkpoint.user != target.user || checkpoint.seed != target.seed)
+        throw std::runtime_error(std::format("Checkpoint '{}' is for {}/{}", settings.checkpoint, checkpoint.user, checkpoint.seed));
+    if(checkpoint.nonce_length != settings.nonce_length || checkpoint.alphabet != settings.alphabet)
+        throw std::runtime_error(std::format("Checkpoint '{}' is for another --nonce-length or --alphabet", settings.checkpoint));
+    if(checkpoint.shard != settings.shard || checkpoint.num_shards != settings.num_shards)
+        throw std::runtime_error(std::format("Checkpoint '{}' is for shard {}/{}", settings.checkpoint, checkpoint.shard, checkpoint.num_shards));
+
+    target.done = checkpoint.done;
+    for(auto& result : checkpoint.best)
+        target.best.push_back(result.nonce);
+}
+
+void handle_signal(int signal)
+{
+    stop_requested = true;
+
+    // Kill the program if the signal comes again
+    std::signal(signal, SIG_DFL);
+}
+
+// The name used in messages about a target, empty if there is only one
+std::string target_name(const Search& search, size_t index)
+{
+    if(search.num_targets() == 1)
+        return "";
+    auto& target = search.target(index);
+    return std::format("{}/{}: ", target.user, target.seed);
+}
+
+// Run all jobs from start to end of all targets that are not done, or
+// until the time is up or the program is interrupted. Returns the
+// number of jobs that were run.
+uint64_t run(
+    Searcher& searcher,
+    Search& search,
+    const Kernels& kernels,
+    const Settings& settings)
+{
+    if(search.num_targets() == 1)
+        output_message("Running with {} threads from {} to {}{} using {}", searcher.num_threads(), settings.start, settings.end, shard_name(settings), describe_kernels(kernels));
+    else
+        output_message("Running {} targets with {} threads using {}", search.num_targets(), searcher.num_threads(), describe_kernels(kernels));
+
+    // The jobs that are not done at the start
+    std::vector<std::vector<std::pair<uint64_t, uint64_t>>> pending_jobs;
+    uint64_t num_pending_jobs = 0;
+    for(size_t i = 0; i < search.num_targets(); i++)
+    {
+        auto& target = search.target(i);
+        auto& pending = pending_jobs.emplace_back(search.done_jobs(i).missing(target.start, target.end));
+        uint64_t num_target_pending = 0;
+        for(auto& [begin, end] : pending)
+            num_target_pending += end - begin;
+        if(num_target_pending < target.end - target.start)
+            output_message("{}{} jobs already done, {} left", target_name(search, i), target.end - target.start - num_target_pending, num_target_pending);
+        num_pending_jobs += num_target_pending;
+    }
+    if(num_pending_jobs == 0)
+        return 0;
+
+    RateReporter reporter(searcher.counters(), double(num_pending_jobs) * 16777216, settings.metrics);
+    searcher.start(search);
+
+    // Wait for the threads to finish. Stop them when the time is up or
+    // the program is interrupted, and write the checkpoint and report the
+    // rate now and then while they are running.
+    {
+        using clock = std::chrono::steady_clock;
+        auto deadline = clock::now() + std::chrono::seconds(settings.duration);
+        auto next_checkpoint = clock::now() + std::chrono::seconds(settings.checkpoint_interval);
+        auto next_report = clock::now() + std::chrono::seconds(settings.report_interval);
+
+        while(!searcher.wait_for(poll_interval))
+        {
+            auto now = clock::now();
+            if(stop_requested || (settings.duration > 0 && now >= deadline))
+                search.stop();
+            if(!settings.checkpoint.empty() && now >= next_checkpoint)
+            {
+                save_checkpoint(settings, search);
+                next_checkpoint = now + std::chrono::seconds(settings.checkpoint_interval);
+            }
+            if(settings.report_interval > 0 && now >= next_report)
+            {
+                reporter.report();
+                next_report = now + std::chrono::seconds(settings.report_interval);
+            }
+        }
+    }
+
+    if(!settings.checkpoint.empty())
+        save_checkpoint(settings, search);
+
+    // The pending jobs were not done at the start, so the ones that are
+    // done now were run. If the search was cancelled, the jobs that were
+    // running are not done.
+    uint64_t num_done = 0;
+    for(size_t i = 0; i < search.num_targets(); i++)
+    {
+        auto done_jobs = search.done_jobs(i);
+        std::vector<std::pair<uint64_t, uint64_t>> processed;
+        uint64_t num_target_pending = 0;
+        uint64_t num_target_done = 0;
+        for(auto& [begin, end] : pending_jobs[i])
+        {
+            num_target_pending += end - begin;
+            for(auto& range : done_jobs.present(begin, end))
+            {
+                processed.push_back(range);
+                num_target_done += range.second - range.first;
+            }
+        }
+        if(num_target_done < num_target_pending)
+            output_message("{}Stopped after {} of {} jobs", target_name(search, i), num_target_done, num_target_pending);
+        for(auto& [begin, end] : processed)
+            output_message("{}Processed {} to {}{}", target_name(search, i), shard_job(settings, begin), shard_job(settings, end - 1) + 1, shard_jobs_name(settings, begin, end));
+        num_done += num_target_done;
+    }
+    return num_done;
 }
 
 //
-// Process one chunk
+// Coordinator and worker mode
 //
-// This function will check the hash of 2^24 strings. The bytes at
-// position 48-51 in the data block will be changed for each string.
+// The coordinator hands out leases on ranges of jobs to the workers. The
+// workers connect with a line based protocol:
 //
-// By starting at position 48, the first 12 rounds of the sha256
-// calculation can be precalculated.
+//   hello 1             -> task username seed top min_zero_bits target nonce_length alphabet
+//   lease               -> lease id begin end seconds | wait seconds | finished
+//   renew id            -> ok | expired | finished
+//   done id [begin end]... -> ok | error
+//   result nonce        -> ok (the coordinator checks the hash itself)
 //
-// This function is based on the code by Jeffrey Walton (see
-// sha256-x86.cpp).
+// done ends the lease, and the [begin, end) ranges are the jobs of the
+// lease that were finished. It is an error if the lease is not one of
+// the worker's, or a range is not inside it, and then none of the jobs
+// count as done. A lease that is not renewed in time, or whose worker
+// disconnects, is handed out again. The target is the --target difficulty as 64 hex
+// digits, or "none". Once a hash below it is found, renew tells the
+// workers to stop. The alphabet is "base64" by default. The coordinator
+// keeps the done jobs and best results in a Search that it never
+// starts, so checkpoints work the same way as in a normal run. Each
+// worker runs a new Search for each lease.
 //
-void process_chunk(const std::array<uint8_t, 64>& input_data)
-{
-    // Number of blocks to process for each iteration in the inner
-    // loop. Only 2, 4, 8, 16 and 32 are valid values. 16 seems to
-    // work best for me.
-    const int num_blocks = 16;
-
-    // Copy the input data
-    alignas(__m128i) std::array<std::array<uint8_t, 64>, num_blocks> data;
-    std::copy(input_data.begin(), input_data.end(), data[0].begin());
-
-    // Duplicate for each block
-    for(int i = 1; i < num_blocks; i++)
-        std::copy(data[0].begin(), data[0].end(), data[i].begin());
-
-    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
-
-    // Set initial state
-    __m128i initial_STATE0 = _mm_set_epi64x(0x6a09e667bb67ae85, 0x510e527f9b05688c);
-    __m128i initial_STATE1 = _mm_set_epi64x(0x3c6ef372a54ff53a, 0x1f83d9ab5be0cd19);
-
-    // Calc first 12 rounds
-    __m128i STATE0 = initial_STATE0;
-    __m128i STATE1 = initial_STATE1;
-
-    __m128i MSG,MSG0,MSG1,MSG2,TMP;
-
-    //
-    // Precalculate the first 12 rounds
-    //
-
-    /* Rounds 0-3 */
-    MSG = _mm_load_si128((const __m128i*) (data[0].data()+0));
-    MSG0 = _mm_shuffle_epi8(MSG, MASK);
-    MSG = _mm_add_epi32(MSG0, _mm_set_epi64x(0xE9B5DBA5B5C0FBCFULL, 0x71374491428A2F98ULL));
-    STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
-    MSG = _mm_shuffle_epi32(MSG, 0x0E);
-    STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
-
-    /* Rounds 4-7 */
-    MSG1 = _mm_load_si128((const __m128i*) (data[0].data()+16));
-    MSG1 = _mm_shuffle_epi8(MSG1, MASK);
-    MSG = _mm_add_epi32(MSG1, _mm_set_epi64x(0xAB1C5ED5923F82A4ULL, 0x59F111F13956C25BULL));
-    STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
-    MSG = _mm_shuffle_epi32(MSG, 0x0E);
-    STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
-    MSG0 = _mm_sha256msg1_epu32(MSG0, MSG1);
-
-    /* Rounds 8-11 */
-    MSG2 = _mm_load_si128((const __m128i*) (data[0].data()+32));
-    MSG2 = _mm_shuffle_epi8(MSG2, MASK);
-    MSG = _mm_add_epi32(MSG2, _mm_set_epi64x(0x550C7DC3243185BEULL, 0x12835B01D807AA98ULL));
-    STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
-    MSG = _mm_shuffle_epi32(MSG, 0x0E);
-    STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
-    MSG1 = _mm_sha256msg1_epu32(MSG1, MSG2);
-
-    // Save state after round 12
-    __m128i round12_STATE0 = STATE0;
-    __m128i round12_STATE1 = STATE1;
-    __m128i round12_MSG0 = MSG0;
-    __m128i round12_MSG1 = MSG1;
-    __m128i round12_MSG2 = MSG2;
-
-    __m128i aSTATE0,aSTATE1,aMSG,aMSG0,aMSG1,aMSG2,aMSG3,aTMP;
-    __m128i bSTATE0,bSTATE1,bMSG,bMSG0,bMSG1,bMSG2,bMSG3,bTMP;
-
-    for(int i012 = 0; i012 < 64*64*64; i012++)
+namespace
+{
+    // How long an idle worker waits before asking for a lease again
+    const unsigned long worker_wait_time = 5;
+
+    // How often the coordinator prints the progress
+    const unsigned long coordinator_progress_interval = 60;
+
+    struct Lease
     {
-        // Set the first 3 characters
-        uint8_t v0 = alphabet[(i012>>12) & 63];
-        uint8_t v1 = alphabet[(i012>>6) & 63];
-        uint8_t v2 = alphabet[(i012>>0) & 63];
-
-        for(int i = 0; i < num_blocks; i++)
-        {
-            data[i][48] = v0;
-            data[i][49] = v1;
-            data[i][50] = v2;
-        }
-
-        // The inner loop
-        for(int i3 = 0; i3 < 64; i3 += num_blocks)
-        {
-            // Set the 4th character
-            for(int i = 0; i < num_blocks; i++)
-                data[i][51] = alphabet[i3 + i];
-
-            // To speed things up, this loop has been unrolled and
-            // calculation of two and two hashes are
-            // interleaved. Interleaving is (probably) faster because
-            // each operation in the sha256 usually depends on the
-            // previous one.
-
-#define V3_INNER(N)  \
-            /* Set start state */ \
-            aSTATE0 = round12_STATE0; \
-            bSTATE0 = round12_STATE0; \
-            aSTATE1 = round12_STATE1; \
-            bSTATE1 = round12_STATE1; \
-            aMSG0 = round12_MSG0; \
-            bMSG0 = round12_MSG0; \
-            aMSG1 = round12_MSG1; \
-            bMSG1 = round12_MSG1; \
-            aMSG2 = round12_MSG2; \
-            bMSG2 = round12_MSG2; \
-            \
-            /* Rounds 12-15 */ \
-            aMSG3 = _mm_load_si128((const __m128i*) (data[(N)+0].data()+48)); \
-            bMSG3 = _mm_load_si128((const __m128i*) (data[(N)+1].data()+48)); \
-            aMSG3 = _mm_shuffle_epi8(aMSG3, MASK); \
-            bMSG3 = _mm_shuffle_epi8(bMSG3, MASK); \
-            aMSG = _mm_add_epi32(aMSG3, _mm_set_epi64x(0xC19BF1749BDC06A7ULL, 0x80DEB1FE72BE5D74ULL)); \
-            bMSG = _mm_add_epi32(bMSG3, _mm_set_epi64x(0xC19BF1749BDC06A7ULL, 0x80DEB1FE72BE5D74ULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aTMP = _mm_alignr_epi8(aMSG3, aMSG2, 4); \
-            bTMP = _mm_alignr_epi8(bMSG3, bMSG2, 4); \
-            aMSG0 = _mm_add_epi32(aMSG0, aTMP); \
-            bMSG0 = _mm_add_epi32(bMSG0, bTMP); \
-            aMSG0 = _mm_sha256msg2_epu32(aMSG0, aMSG3); \
-            bMSG0 = _mm_sha256msg2_epu32(bMSG0, bMSG3); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            aMSG2 = _mm_sha256msg1_epu32(aMSG2, aMSG3); \
-            bMSG2 = _mm_sha256msg1_epu32(bMSG2, bMSG3); \
-            \
-            /* Rounds 16-19 */ \
-            aMSG = _mm_add_epi32(aMSG0, _mm_set_epi64x(0x240CA1CC0FC19DC6ULL, 0xEFBE4786E49B69C1ULL)); \
-            bMSG = _mm_add_epi32(bMSG0, _mm_set_epi64x(0x240CA1CC0FC19DC6ULL, 0xEFBE4786E49B69C1ULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aTMP = _mm_alignr_epi8(aMSG0, aMSG3, 4); \
-            bTMP = _mm_alignr_epi8(bMSG0, bMSG3, 4); \
-            aMSG1 = _mm_add_epi32(aMSG1, aTMP); \
-            bMSG1 = _mm_add_epi32(bMSG1, bTMP); \
-            aMSG1 = _mm_sha256msg2_epu32(aMSG1, aMSG0); \
-            bMSG1 = _mm_sha256msg2_epu32(bMSG1, bMSG0); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            aMSG3 = _mm_sha256msg1_epu32(aMSG3, aMSG0); \
-            bMSG3 = _mm_sha256msg1_epu32(bMSG3, bMSG0); \
-            \
-            /* Rounds 20-23 */ \
-            aMSG = _mm_add_epi32(aMSG1, _mm_set_epi64x(0x76F988DA5CB0A9DCULL, 0x4A7484AA2DE92C6FULL)); \
-            bMSG = _mm_add_epi32(bMSG1, _mm_set_epi64x(0x76F988DA5CB0A9DCULL, 0x4A7484AA2DE92C6FULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aTMP = _mm_alignr_epi8(aMSG1, aMSG0, 4); \
-            bTMP = _mm_alignr_epi8(bMSG1, bMSG0, 4); \
-            aMSG2 = _mm_add_epi32(aMSG2, aTMP); \
-            bMSG2 = _mm_add_epi32(bMSG2, bTMP); \
-            aMSG2 = _mm_sha256msg2_epu32(aMSG2, aMSG1); \
-            bMSG2 = _mm_sha256msg2_epu32(bMSG2, bMSG1); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            aMSG0 = _mm_sha256msg1_epu32(aMSG0, aMSG1); \
-            bMSG0 = _mm_sha256msg1_epu32(bMSG0, bMSG1); \
-            \
-            /* Rounds 24-27 */ \
-            aMSG = _mm_add_epi32(aMSG2, _mm_set_epi64x(0xBF597FC7B00327C8ULL, 0xA831C66D983E5152ULL)); \
-            bMSG = _mm_add_epi32(bMSG2, _mm_set_epi64x(0xBF597FC7B00327C8ULL, 0xA831C66D983E5152ULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aTMP = _mm_alignr_epi8(aMSG2, aMSG1, 4); \
-            bTMP = _mm_alignr_epi8(bMSG2, bMSG1, 4); \
-            aMSG3 = _mm_add_epi32(aMSG3, aTMP); \
-            bMSG3 = _mm_add_epi32(bMSG3, bTMP); \
-            aMSG3 = _mm_sha256msg2_epu32(aMSG3, aMSG2); \
-            bMSG3 = _mm_sha256msg2_epu32(bMSG3, bMSG2); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            aMSG1 = _mm_sha256msg1_epu32(aMSG1, aMSG2); \
-            bMSG1 = _mm_sha256msg1_epu32(bMSG1, bMSG2); \
-            \
-            /* Rounds 28-31 */ \
-            aMSG = _mm_add_epi32(aMSG3, _mm_set_epi64x(0x1429296706CA6351ULL,  0xD5A79147C6E00BF3ULL)); \
-            bMSG = _mm_add_epi32(bMSG3, _mm_set_epi64x(0x1429296706CA6351ULL,  0xD5A79147C6E00BF3ULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aTMP = _mm_alignr_epi8(aMSG3, aMSG2, 4); \
-            bTMP = _mm_alignr_epi8(bMSG3, bMSG2, 4); \
-            aMSG0 = _mm_add_epi32(aMSG0, aTMP); \
-            bMSG0 = _mm_add_epi32(bMSG0, bTMP); \
-            aMSG0 = _mm_sha256msg2_epu32(aMSG0, aMSG3); \
-            bMSG0 = _mm_sha256msg2_epu32(bMSG0, bMSG3); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            aMSG2 = _mm_sha256msg1_epu32(aMSG2, aMSG3); \
-            bMSG2 = _mm_sha256msg1_epu32(bMSG2, bMSG3); \
-            \
-            /* Rounds 32-35 */ \
-            aMSG = _mm_add_epi32(aMSG0, _mm_set_epi64x(0x53380D134D2C6DFCULL, 0x2E1B213827B70A85ULL)); \
-            bMSG = _mm_add_epi32(bMSG0, _mm_set_epi64x(0x53380D134D2C6DFCULL, 0x2E1B213827B70A85ULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aTMP = _mm_alignr_epi8(aMSG0, aMSG3, 4); \
-            bTMP = _mm_alignr_epi8(bMSG0, bMSG3, 4); \
-            aMSG1 = _mm_add_epi32(aMSG1, aTMP); \
-            bMSG1 = _mm_add_epi32(bMSG1, bTMP); \
-            aMSG1 = _mm_sha256msg2_epu32(aMSG1, aMSG0); \
-            bMSG1 = _mm_sha256msg2_epu32(bMSG1, bMSG0); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            aMSG3 = _mm_sha256msg1_epu32(aMSG3, aMSG0); \
-            bMSG3 = _mm_sha256msg1_epu32(bMSG3, bMSG0); \
-            \
-            /* Rounds 36-39 */ \
-            aMSG = _mm_add_epi32(aMSG1, _mm_set_epi64x(0x92722C8581C2C92EULL, 0x766A0ABB650A7354ULL)); \
-            bMSG = _mm_add_epi32(bMSG1, _mm_set_epi64x(0x92722C8581C2C92EULL, 0x766A0ABB650A7354ULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aTMP = _mm_alignr_epi8(aMSG1, aMSG0, 4); \
-            bTMP = _mm_alignr_epi8(bMSG1, bMSG0, 4); \
-            aMSG2 = _mm_add_epi32(aMSG2, aTMP); \
-            bMSG2 = _mm_add_epi32(bMSG2, bTMP); \
-            aMSG2 = _mm_sha256msg2_epu32(aMSG2, aMSG1); \
-            bMSG2 = _mm_sha256msg2_epu32(bMSG2, bMSG1); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            aMSG0 = _mm_sha256msg1_epu32(aMSG0, aMSG1); \
-            bMSG0 = _mm_sha256msg1_epu32(bMSG0, bMSG1); \
-            \
-            /* Rounds 40-43 */ \
-            aMSG = _mm_add_epi32(aMSG2, _mm_set_epi64x(0xC76C51A3C24B8B70ULL, 0xA81A664BA2BFE8A1ULL)); \
-            bMSG = _mm_add_epi32(bMSG2, _mm_set_epi64x(0xC76C51A3C24B8B70ULL, 0xA81A664BA2BFE8A1ULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aTMP = _mm_alignr_epi8(aMSG2, aMSG1, 4); \
-            bTMP = _mm_alignr_epi8(bMSG2, bMSG1, 4); \
-            aMSG3 = _mm_add_epi32(aMSG3, aTMP); \
-            bMSG3 = _mm_add_epi32(bMSG3, bTMP); \
-            aMSG3 = _mm_sha256msg2_epu32(aMSG3, aMSG2); \
-            bMSG3 = _mm_sha256msg2_epu32(bMSG3, bMSG2); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            aMSG1 = _mm_sha256msg1_epu32(aMSG1, aMSG2); \
-            bMSG1 = _mm_sha256msg1_epu32(bMSG1, bMSG2); \
-            \
-            /* Rounds 44-47 */ \
-            aMSG = _mm_add_epi32(aMSG3, _mm_set_epi64x(0x106AA070F40E3585ULL, 0xD6990624D192E819ULL)); \
-            bMSG = _mm_add_epi32(bMSG3, _mm_set_epi64x(0x106AA070F40E3585ULL, 0xD6990624D192E819ULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aTMP = _mm_alignr_epi8(aMSG3, aMSG2, 4); \
-            bTMP = _mm_alignr_epi8(bMSG3, bMSG2, 4); \
-            aMSG0 = _mm_add_epi32(aMSG0, aTMP); \
-            bMSG0 = _mm_add_epi32(bMSG0, bTMP); \
-            aMSG0 = _mm_sha256msg2_epu32(aMSG0, aMSG3); \
-            bMSG0 = _mm_sha256msg2_epu32(bMSG0, bMSG3); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            aMSG2 = _mm_sha256msg1_epu32(aMSG2, aMSG3); \
-            bMSG2 = _mm_sha256msg1_epu32(bMSG2, bMSG3); \
-            \
-            /* Rounds 48-51 */ \
-            aMSG = _mm_add_epi32(aMSG0, _mm_set_epi64x(0x34B0BCB52748774CULL, 0x1E376C0819A4C116ULL)); \
-            bMSG = _mm_add_epi32(bMSG0, _mm_set_epi64x(0x34B0BCB52748774CULL, 0x1E376C0819A4C116ULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aTMP = _mm_alignr_epi8(aMSG0, aMSG3, 4); \
-            bTMP = _mm_alignr_epi8(bMSG0, bMSG3, 4); \
-            aMSG1 = _mm_add_epi32(aMSG1, aTMP); \
-            bMSG1 = _mm_add_epi32(bMSG1, bTMP); \
-            aMSG1 = _mm_sha256msg2_epu32(aMSG1, aMSG0); \
-            bMSG1 = _mm_sha256msg2_epu32(bMSG1, bMSG0); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            aMSG3 = _mm_sha256msg1_epu32(aMSG3, aMSG0); \
-            bMSG3 = _mm_sha256msg1_epu32(bMSG3, bMSG0); \
-            \
-            /* Rounds 52-55 */ \
-            aMSG = _mm_add_epi32(aMSG1, _mm_set_epi64x(0x682E6FF35B9CCA4FULL, 0x4ED8AA4A391C0CB3ULL)); \
-            bMSG = _mm_add_epi32(bMSG1, _mm_set_epi64x(0x682E6FF35B9CCA4FULL, 0x4ED8AA4A391C0CB3ULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aTMP = _mm_alignr_epi8(aMSG1, aMSG0, 4); \
-            bTMP = _mm_alignr_epi8(bMSG1, bMSG0, 4); \
-            aMSG2 = _mm_add_epi32(aMSG2, aTMP); \
-            bMSG2 = _mm_add_epi32(bMSG2, bTMP); \
-            aMSG2 = _mm_sha256msg2_epu32(aMSG2, aMSG1); \
-            bMSG2 = _mm_sha256msg2_epu32(bMSG2, bMSG1); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            \
-            /* Rounds 56-59 */ \
-            aMSG = _mm_add_epi32(aMSG2, _mm_set_epi64x(0x8CC7020884C87814ULL, 0x78A5636F748F82EEULL)); \
-            bMSG = _mm_add_epi32(bMSG2, _mm_set_epi64x(0x8CC7020884C87814ULL, 0x78A5636F748F82EEULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aTMP = _mm_alignr_epi8(aMSG2, aMSG1, 4); \
-            bTMP = _mm_alignr_epi8(bMSG2, bMSG1, 4); \
-            aMSG3 = _mm_add_epi32(aMSG3, aTMP); \
-            bMSG3 = _mm_add_epi32(bMSG3, bTMP); \
-            aMSG3 = _mm_sha256msg2_epu32(aMSG3, aMSG2); \
-            bMSG3 = _mm_sha256msg2_epu32(bMSG3, bMSG2); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            \
-            /* Rounds 60-63 */ \
-            aMSG = _mm_add_epi32(aMSG3, _mm_set_epi64x(0xC67178F2BEF9A3F7ULL, 0xA4506CEB90BEFFFAULL)); \
-            bMSG = _mm_add_epi32(bMSG3, _mm_set_epi64x(0xC67178F2BEF9A3F7ULL, 0xA4506CEB90BEFFFAULL)); \
-            aSTATE1 = _mm_sha256rnds2_epu32(aSTATE1, aSTATE0, aMSG); \
-            bSTATE1 = _mm_sha256rnds2_epu32(bSTATE1, bSTATE0, bMSG); \
-            aMSG = _mm_shuffle_epi32(aMSG, 0x0E); \
-            bMSG = _mm_shuffle_epi32(bMSG, 0x0E); \
-            aSTATE0 = _mm_sha256rnds2_epu32(aSTATE0, aSTATE1, aMSG); \
-            bSTATE0 = _mm_sha256rnds2_epu32(bSTATE0, bSTATE1, bMSG); \
-            \
-            /* Combine state  */ \
-            aSTATE0 = _mm_add_epi32(aSTATE0, initial_STATE0); \
-            bSTATE0 = _mm_add_epi32(bSTATE0, initial_STATE0); \
-            \
-            check_result(aSTATE0, data[(N)+0]);    \
-            check_result(bSTATE0, data[(N)+1]);
-
-            V3_INNER(0);
-            if constexpr(num_blocks >= 4)
+        uint64_t begin;
+        uint64_t end;
+        std::chrono::steady_clock::time_point deadline;
+        uint64_t worker;
+    };
+
+    // The leases and number of workers
+    std::mutex lease_mutex;
+    std::map<uint64_t, Lease> leases;
+    uint64_t next_lease_id = 1;
+    unsigned long num_workers = 0;
+
+    // Signalled when jobs are done or a worker disconnects
+    std::condition_variable coordinator_cv;
+}
+
+// Hand out the first jobs that are neither done nor leased. Must be
+// called with lease_mutex locked.
+std::string lease_jobs(Search& search, const Settings& settings, uint64_t worker)
+{
+    if(search.hit())
+        return "finished";
+
+    auto done_jobs = search.done_jobs(0);
+    auto now = std::chrono::steady_clock::now();
+    RangeSet busy = done_jobs;
+    for(auto it = leases.begin(); it != leases.end();)
+    {
+        if(it->second.deadline < now)
+        {
+            output_message("Lease {} ({} to {}) expired", it->first, it->second.begin, it->second.end);
+            it = leases.erase(it);
+        }
+        else
+        {
+            busy.add(it->second.begin, it->second.end);
+            ++it;
+        }
+    }
+
+    auto free = busy.missing(settings.start, settings.end);
+    if(free.empty())
+    {
+        if(done_jobs.count(settings.start, settings.end) == settings.end - settings.start)
+            return "finished";
+        return std::format("wait {}", worker_wait_time);
+    }
+
+    uint64_t begin = free.front().first;
+    uint64_t end = std::min(free.front().second, begin + settings.lease_size);
+    uint64_t id = next_lease_id++;
+    leases[id] = { begin, end, now + std::chrono::seconds(settings.lease_time), worker };
+    return std::format("lease {} {} {} {}", id, begin, end, settings.lease_time);
+}
+
+void handle_worker(Connection connection, uint64_t worker, Search& search, const Settings& settings)
+{
+    try
+    {
+        for(;;)
+        {
+            auto line = connection.read_line();
+            std::istringstream stream(line);
+            std::string command;
+            stream >> command;
+
+            std::string reply = "error";
+            if(command == "hello")
+            {
+                reply = std::format("task {} {} {} {} {} {} {}", settings.user, settings.seed, settings.top, settings.min_zero_bits,
+                    settings.difficulty ? format_difficulty(*settings.difficulty) : "none",
+                    settings.nonce_length, settings.alphabet.empty() ? "base64" : settings.alphabet);
+            }
+            else if(command == "lease")
             {
-                V3_INNER(2);
+                std::lock_guard lock(lease_mutex);
+                reply = lease_jobs(search, settings, worker);
             }
-            if constexpr(num_blocks >= 8)
+            else if(command == "renew")
             {
-                V3_INNER(4);
-                V3_INNER(6);
+                uint64_t id;
+                stream >> id;
+                std::lock_guard lock(lease_mutex);
+                auto it = leases.find(id);
+                if(search.hit())
+                {
+                    reply = "finished";
+                }
+                else if(!stream.fail() && it != leases.end() && it->second.worker == worker)
+                {
+                    it->second.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(settings.lease_time);
+                    reply = "ok";
+                }
+                else
+                {
+                    reply = "expired";
+                }
             }
-            if constexpr(num_blocks >= 16)
+            else if(command == "done")
             {
-                V3_INNER(8);
-                V3_INNER(10);
-                V3_INNER(12);
-                V3_INNER(14);
+                uint64_t id = 0;
+                stream >> id;
+                std::vector<uint64_t> values;
+                uint64_t value;
+                while(stream >> value)
+                    values.push_back(value);
+
+                std::lock_guard lock(lease_mutex);
+                auto it = leases.find(id);
+                bool valid = stream.eof() && values.size() % 2 == 0 && it != leases.end() && it->second.worker == worker;
+                for(size_t i = 0; valid && i < values.size(); i += 2)
+                    valid = values[i] < values[i + 1] && values[i] >= it->second.begin && values[i + 1] <= it->second.end;
+                if(valid)
+                {
+                    for(size_t i = 0; i < values.size(); i += 2)
+                        search.add_done_jobs(0, values[i], values[i + 1]);
+                    leases.erase(it);
+                    coordinator_cv.notify_all();
+                    reply = "ok";
+                }
             }
-            if constexpr(num_blocks >= 32)
+            else if(command == "result")
             {
-                V3_INNER(16);
-                V3_INNER(18);
-                V3_INNER(20);
-                V3_INNER(22);
-                V3_INNER(24);
-                V3_INNER(26);
-                V3_INNER(28);
-                V3_INNER(30);
+                // The coordinator checks the hash of the nonce itself
+                std::string nonce;
+                stream >> nonce;
+                try
+                {
+                    search.add_nonce(0, nonce);
+                    if(search.hit())
+                    {
+                        std::lock_guard lock(lease_mutex);
+                        coordinator_cv.notify_all();
+                    }
+                    reply = "ok";
+                }
+                catch(std::runtime_error&)
+                {
+                }
             }
+            connection.write_line(reply);
         }
     }
+    catch(std::exception&)
+    {
+    }
+
+    // Hand out the leases of the worker again
+    std::lock_guard lock(lease_mutex);
+    std::erase_if(leases, [&](auto& item) { return item.second.worker == worker; });
+    num_workers--;
+    coordinator_cv.notify_all();
 }
 
-void thread_func(const std::array<uint8_t, 64>& input_block, uint64_t job_limit)
+// Serve the jobs from start to end to the workers until all are done.
+// Returns the number of jobs that were done.
+uint64_t run_coordinator(Search& search, const Settings& settings)
 {
-    // Make a copy of the input block
-    alignas(__m128i) std::array<uint8_t, 64> block = input_block;
+    output_message("Coordinating jobs from {} to {} on {}", settings.start, settings.end, settings.coordinator);
+
+    uint64_t num_done_before = search.done_jobs(0).count(settings.start, settings.end);
+    uint64_t num_jobs = settings.end - settings.start;
 
-    // Run the loop as long as there are jobs
-    for(;;)
+    // The listener lives until the program exits, since the thread
+    // that accepts the connections is never joined
+    static std::optional<Listener> listener;
+    listener.emplace(settings.coordinator);
+    std::thread([&search, &settings]() {
+        try
+        {
+            for(uint64_t worker = 1;; worker++)
+            {
+                auto connection = listener->accept();
+                std::lock_guard lock(lease_mutex);
+                num_workers++;
+                std::thread(handle_worker, std::move(connection), worker, std::ref(search), std::cref(settings)).detach();
+            }
+        }
+        catch(std::exception&)
+        {
+        }
+    }).detach();
+
+    using clock = std::chrono::steady_clock;
+    auto next_checkpoint = clock::now() + std::chrono::seconds(settings.checkpoint_interval);
+    auto next_progress = clock::now() + std::chrono::seconds(coordinator_progress_interval);
+    std::optional<clock::time_point> finish_time;
+
+    std::unique_lock lock(lease_mutex);
+    while(!stop_requested)
     {
-        uint64_t counter = job_counter.fetch_add(1U);
-        if(counter >= job_limit)
+        // Give the workers some time to ask for a lease and be told
+        // that there are no more jobs. After a hash below the target is
+        // found, the workers are told when they renew their lease.
+        auto now = clock::now();
+        bool found = search.hit().has_value();
+        uint64_t num_done = search.done_jobs(0).count(settings.start, settings.end);
+        if(!finish_time && (found || num_done == num_jobs))
+            finish_time = now;
+        auto grace_time = std::chrono::seconds(found ? settings.lease_time : 2*worker_wait_time);
+        if(finish_time && (num_workers == 0 || now > *finish_time + grace_time))
             break;
-        if(counter > 0 && (counter & 65535) == 0)
+
+        if(now >= next_progress)
         {
-            std::lock_guard lock(print_mutex);
-            print("Progress: {}\n", counter);
+            output_message("Progress: {} of {} jobs done, {} workers", num_done, num_jobs, num_workers);
+            next_progress = now + std::chrono::seconds(coordinator_progress_interval);
         }
-        // Write counter as 8 character string (backwards)
-        for(int i = 47; i > 47-8; i--)
+        if(!settings.checkpoint.empty() && now >= next_checkpoint)
         {
-            block[i] = alphabet[counter % 64U];
-            counter /= 64U;
+            lock.unlock();
+            save_checkpoint(settings, search);
+            lock.lock();
+            next_checkpoint = now + std::chrono::seconds(settings.checkpoint_interval);
         }
 
-        process_chunk(block);
+        // Wake up now and then to see if the program was interrupted
+        coordinator_cv.wait_for(lock, std::chrono::seconds(1));
     }
+    lock.unlock();
+
+    uint64_t num_done = search.done_jobs(0).count(settings.start, settings.end) - num_done_before;
+    if(!settings.checkpoint.empty())
+        save_checkpoint(settings, search);
+    if(num_done_before + num_done < num_jobs)
+        output_message("Stopped after {} of {} jobs", num_done_before + num_done, num_jobs);
+    return num_done;
 }
 
-void run(
-    const std::array<uint8_t, 64>& block,
-    unsigned long num_threads,
-    uint64_t start, uint64_t end)
+// Get leases from the coordinator and run them until all jobs are done.
+// Each lease is a new search on the same threads, which starts with the
+// best results of the one before. The last search is left in search.
+// Returns the number of jobs that were run.
+uint64_t run_worker(
+    Connection& connection,
+    Searcher& searcher,
+    std::unique_ptr<Search>& search,
+    const Kernels& kernels,
+    const Settings& settings)
 {
-    print("Running with {} threads from {} to {}\n", num_threads, start, end);
+    std::mutex connection_mutex;
+    auto request = [&](const std::string& line) {
+        std::lock_guard lock(connection_mutex);
+        return connection.request(line);
+    };
 
-    job_counter = start;
-    std::vector<std::thread> threads;
-    for(unsigned int i = 0; i < num_threads; i++)
-        threads.push_back(std::thread(thread_func, block, end));
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(settings.duration);
+    std::set<std::string> reported_nonces;
+    uint64_t num_jobs = 0;
+    while(!stop_requested)
+    {
+        Settings lease_settings = settings;
+        if(settings.duration > 0)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::seconds>(deadline - std::chrono::steady_clock::now());
+            if(remaining.count() < 1)
+                break;
+            lease_settings.duration = (unsigned long)remaining.count();
+        }
 
-    for(auto& thread : threads)
-        thread.join();
-}
+        auto reply = request("lease");
+        std::istringstream stream(reply);
+        std::string type;
+        stream >> type;
+        if(type == "finished")
+            break;
+        if(type == "wait")
+        {
+            unsigned long seconds = worker_wait_time;
+            stream >> seconds;
+            for(unsigned long i = 0; i < 10*seconds && !stop_requested; i++)
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
 
-// Create the prefix, which is username/seed/ padded with /'s up to 40 bytes
-std::array<uint8_t, 40> create_padded_prefix(
-    const std::string& username,
-    const std::string& seed)
-{
-    std::string temp = username;
-    temp += "/";
-    temp += seed;
-    temp += "/";
-
-    std::array<uint8_t, 40> output;
-    if(temp.size() > output.size())
-        throw std::runtime_error("username/prefix too long");
-
-    size_t i = 0;
-    for(; i < temp.size(); i++)
-        output[i] = uint8_t(temp[i]);
-    for(;i < output.size(); i++)
-        output[i] = '/';
-    return output;
-}
+        uint64_t id, begin, end;
+        unsigned long lease_time;
+        stream >> id >> begin >> end >> lease_time;
+        if(type != "lease" || stream.fail() || begin >= end || end > max_jobs(settings.nonce_length))
+            throw std::runtime_error(std::format("Invalid reply '{}' from coordinator", reply));
+        lease_settings.start = begin;
+        lease_settings.end = end;
 
-std::array<uint8_t, 64> create_block(
-    const std::array<uint8_t, 40>& prefix)
-{
-    std::array<uint8_t, 64> block { 0 };
+        std::vector<SearchTarget> targets(1);
+        targets[0].user = settings.user;
+        targets[0].seed = settings.seed;
+        targets[0].start = begin;
+        targets[0].end = end;
+        if(search)
+        {
+            for(auto& result : search->best(0))
+                targets[0].best.push_back(result.nonce);
+        }
+        search = std::make_unique<Search>(targets, make_search_options(settings, kernels, targets));
+
+        // Renew the lease while the jobs are running
+        std::mutex renew_mutex;
+        std::condition_variable renew_cv;
+        bool lease_finished = false;
+        std::thread renew_thread([&]() {
+            std::unique_lock lock(renew_mutex);
+            auto interval = std::chrono::seconds(std::max(1UL, lease_time / 3));
+            while(!renew_cv.wait_for(lock, interval, [&]() { return lease_finished; }))
+            {
+                lock.unlock();
+                try
+                {
+                    // Another worker found a hash below the target
+                    if(request(std::format("renew {}", id)) == "finished")
+                    {
+                        stop_requested = true;
+                        search->cancel();
+                        output_message("Another worker found a hash below the target");
+                    }
+                }
+                catch(std::exception&)
+                {
+                }
+                lock.lock();
+            }
+        });
+
+        num_jobs += run(searcher, *search, kernels, lease_settings);
+
+        {
+            std::lock_guard lock(renew_mutex);
+            lease_finished = true;
+            renew_cv.notify_all();
+        }
+        renew_thread.join();
 
-    // Put the prefix at the beginning
-    std::copy(prefix.begin(), prefix.end(), block.begin());
+        // Report the jobs that are done, which is not all of them if the
+        // program was stopped, and end the lease
+        std::string done_line = std::format("done {}", id);
+        for(auto& [done_begin, done_end] : search->done_jobs(0).present(begin, end))
+            done_line += std::format(" {} {}", done_begin, done_end);
+        if(request(done_line) != "ok")
+            output_message("The coordinator didn't take the jobs of lease {}, which had expired", id);
 
-    // Set end padding and size
-    const uint16_t size = 52 * 8;
-    block[52] = 0x80;
-    block[62] = size >> 8;
-    block[63] = size & 255;
-    return block;
+        // Report the results on the leaderboard that are new
+        for(auto& result : search->best(0))
+        {
+            if(reported_nonces.insert(result.nonce).second)
+                request(std::format("result {}", result.nonce));
+        }
+
+        // The hash below the target may not be on the leaderboard
+        if(auto hit = search->hit())
+        {
+            request(std::format("result {}", hit->nonce));
+            break;
+        }
+    }
+    return num_jobs;
 }
 
 template<typename T>
@@ -570,46 +814,148 @@ template<> unsigned long long parse<unsigned long long>(const std::string& str)
     return value;
 }
 
-void validate_string(const std::string& string)
+
+// Read the targets for --batch. Each line is "username seed [start end
+// [weight]]". Empty lines and lines starting with # are skipped. The
+// range is all jobs up to max_jobs if it is not given.
+std::vector<SearchTarget> read_targets(const std::string& path, uint64_t max_jobs)
 {
-    std::set<char> valid_chars;
-    for(uint8_t* ptr = alphabet; ptr != alphabet+64; ++ptr)
-        valid_chars.insert(*ptr);
+    std::ifstream file(path);
+    if(!file)
+        throw std::runtime_error(std::format("Can't read batch file '{}'", path));
 
-    for(auto ch : string)
+    std::vector<SearchTarget> targets;
+    std::string line;
+    while(std::getline(file, line))
     {
-        if(!valid_chars.contains(ch))
-            throw std::runtime_error(std::format("Invalid characters in '{}'", string));
+        std::istringstream stream(line);
+        std::vector<std::string> fields;
+        std::string field;
+        while(stream >> field)
+            fields.push_back(field);
+        if(fields.empty() || fields[0][0] == '#')
+            continue;
+        if(fields.size() != 2 && fields.size() != 4 && fields.size() != 5)
+            throw std::runtime_error(std::format("Invalid line '{}' in batch file, expected username seed [start end [weight]]", line));
+
+        auto& target = targets.emplace_back();
+        target.user = fields[0];
+        target.seed = fields[1];
+        target.end = max_jobs;
+        validate_string(target.user);
+        validate_string(target.seed);
+        if(fields.size() >= 4)
+        {
+            target.start = parse<uint64_t>(fields[2]);
+            target.end = parse<uint64_t>(fields[3]);
+            if(target.start >= target.end || target.end > max_jobs)
+                throw std::runtime_error(std::format("Invalid range in '{}', must be start < end <= {}", line, max_jobs));
+        }
+        if(fields.size() >= 5)
+        {
+            target.weight = parse<unsigned long>(fields[4]);
+            if(target.weight < 1)
+                throw std::runtime_error(std::format("Invalid weight in '{}', minimum is 1", line));
+        }
     }
+    if(targets.empty())
+        throw std::runtime_error(std::format("No targets in batch file '{}'", path));
+    return targets;
+}
+
+
+// --target is a number of zero bits at the start of the hash, or 64 hex
+// digits that the hash must be below
+std::array<uint32_t, 8> parse_difficulty(const std::string& str)
+{
+    std::array<uint32_t, 8> output { 0 };
+    if(str.size() == 64)
+    {
+        for(auto ch : str)
+        {
+            if(!std::isxdigit((unsigned char)ch))
+                throw std::runtime_error(std::format("Invalid target '{}'", str));
+        }
+        for(int i = 0; i < 8; i++)
+            output[i] = uint32_t(std::stoul(str.substr(8*i, 8), nullptr, 16));
+        if(output == std::array<uint32_t, 8> { 0 })
+            throw std::runtime_error("Target must be above 0");
+        return output;
+    }
+
+    auto bits = parse<unsigned long>(str);
+    if(bits < 1 || bits > 255)
+        throw std::runtime_error("Target must be from 1 to 255 zero bits, or 64 hex digits");
+    auto position = 256 - bits;
+    output[7 - position / 32] = 1U << (position % 32);
+    return output;
+}
+
+void validate_leaderboard(const Settings& settings)
+{
+    if(settings.top < 1 || settings.top > 10000)
+        throw std::runtime_error("Leaderboard size must be from 1 to 10000");
+    if(settings.min_zero_bits < 16 || settings.min_zero_bits > 64)
+        throw std::runtime_error("Minimum number of zero bits must be from 16 to 64");
 }
 
 [[noreturn]] void print_help_and_exit(const std::string& program)
 {
-    print("Usage: {} [-b] [-t num] [-s start] [-e end] username seed\n", program);
+    print("Usage: {} [-b] [-t num] [-s start] [-e end] [-d seconds] [-k kernel] [--tune] [-c file [--resume]] username seed\n", program);
+    print("       {} --batch file [-t num] [-d seconds] [-k kernel]\n", program);
+    print("       {} --coordinator address [options] username seed\n", program);
+    print("       {} --worker address [-t num] [-d seconds] [-k kernel]\n", program);
+    print("       {} --verify file [-t num] [--top num]\n", program);
     print("  -b/--benchmark    : Run benchmark\n");
     print("  -t/--threads num  : Set number of threads\n");
     print("  -s/--start num    : Set start position\n");
     print("  -e/--end num      : Set end position\n");
+    print("  -d/--duration seconds : Stop after this many seconds\n");
+    print("  --affinity policy : Pin the threads to CPUs: compact, scatter, physical or none (default)\n");
+    print("  --numa-nodes list : Only use the CPUs in these NUMA nodes (e.g. 0,1) with --affinity\n");
+    print("  --top num         : Keep the best num results and print them at the end (default 1)\n");
+    print("  --min-zero-bits num : Only keep results that start with this many zero bits, 16 to 64 (default 32)\n");
+    print("  --target bits|hex : Stop at the first hash that starts with this many zero bits, or is below the 64 hex digits\n");
+    print("  --nonce-length num : Characters in the nonce, 12 to 14, each one more gives 64 times the jobs (default 12)\n");
+    print("  --alphabet chars  : The 64 characters of the nonce (default is base64)\n");
+    print("  --shard i/N       : Only run every Nth job from start to end, starting with job i (0 to N-1)\n");
+    print("  -k/--kernel name  : Set kernel (default is the fastest supported)\n");
+    print("  --list-kernels    : List the kernels and exit\n");
+    print("  --format format   : Print text (default) or JSON Lines\n");
+    print("  --report-interval seconds : Time between hash rate reports, 0 for none (default 60)\n");
+    print("  --metrics file    : Write the hash rates to file in the Prometheus text format at each report\n");
+    print("  --tune            : Time the kernels again instead of using the cached choice\n");
+    print("  -c/--checkpoint file : Save the finished jobs and best result to file, which must not exist without --resume\n");
+    print("  --checkpoint-interval seconds : Time between checkpoints (default 60)\n");
+    print("  --resume          : Skip the jobs that are done according to the checkpoint, if it exists\n");
+    print("  --batch file      : Search all targets in file, one \"username seed [start end [weight]]\" per line\n");
+    print("  --coordinator address : Hand out the jobs to workers on host:port or unix:path\n");
+    print("  --worker address  : Run the jobs from the coordinator at address\n");
+    print("  --lease-size num  : Number of jobs per lease (default 1024)\n");
+    print("  --lease-time seconds : Time before a lease that is not renewed expires (default 60)\n");
+    print("  --verify file     : Check the hashes of the messages or results in file (- for stdin) and print the best\n");
     print("");
     std::exit(0);
 }
 
-auto parse_arguments(int argc, char** argv)
+[[noreturn]] void list_kernels_and_exit()
 {
-    struct
-    {
-        unsigned long num_threads = std::max(1U, std::thread::hardware_concurrency());
-        uint64_t start = 0;
-        uint64_t end = max_position;
-        std::string user;
-        std::string seed;
-    } output;
+    for(auto& kernel : get_kernels())
+        print("{:<10} {:<40} {}\n", kernel.name, kernel.description, kernel.supported() ? "supported" : "not supported");
+    std::exit(0);
+}
+
+Settings parse_arguments(int argc, char** argv)
+{
+    Settings output;
 
     std::list<std::string> args;
     for(int i = 1; i < argc; i++)
         args.push_back(argv[i]);
 
     bool start_or_end_set = false;
+    bool end_set = false;
+    bool nonce_set = false;
     bool benchmark = false;
     while(!args.empty())
     {
@@ -638,13 +984,183 @@ auto parse_arguments(int argc, char** argv)
             if(output.num_threads < 1)
                 throw std::runtime_error("Minimum number of threads is 1");
         }
+        else if(arg == "-d" || arg == "--duration")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing duration argument");
+            output.duration = parse<unsigned long>(pop(args));
+            if(output.duration < 1)
+                throw std::runtime_error("Minimum duration is 1 second");
+        }
+        else if(arg == "--affinity")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing affinity policy argument");
+            output.affinity = parse_affinity_policy(pop(args));
+        }
+        else if(arg == "--numa-nodes")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing NUMA node list argument");
+            std::istringstream stream(pop(args));
+            std::string node;
+            while(std::getline(stream, node, ','))
+                output.numa_nodes.push_back(int(parse<unsigned long>(node)));
+        }
+        else if(arg == "--format")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing output format argument");
+            auto format = pop(args);
+            if(format == "text")
+                output.format = OutputFormat::text;
+            else if(format == "json")
+                output.format = OutputFormat::json;
+            else
+                throw std::runtime_error(std::format("Unknown output format '{}', expected text or json", format));
+        }
+        else if(arg == "--report-interval")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing report interval argument");
+            output.report_interval = parse<unsigned long>(pop(args));
+        }
+        else if(arg == "--metrics")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing metrics file argument");
+            output.metrics = pop(args);
+        }
+        else if(arg == "--top")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing leaderboard size argument");
+            output.top = parse<unsigned long>(pop(args));
+        }
+        else if(arg == "--min-zero-bits")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing number of zero bits argument");
+            output.min_zero_bits = parse<unsigned long>(pop(args));
+        }
+        else if(arg == "--target")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing target argument");
+            output.difficulty = parse_difficulty(pop(args));
+        }
+        else if(arg == "--nonce-length")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing nonce length argument");
+            output.nonce_length = unsigned(parse<unsigned long>(pop(args)));
+            if(output.nonce_length < min_nonce_length || output.nonce_length > max_nonce_length)
+                throw std::runtime_error(std::format("Nonce length must be from {} to {}", min_nonce_length, max_nonce_length));
+            nonce_set = true;
+        }
+        else if(arg == "--alphabet")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing alphabet argument");
+            output.alphabet = pop(args);
+            validate_alphabet(output.alphabet);
+
+            // The default is stored as empty, so that it matches in
+            // checkpoints
+            if(output.alphabet == std::string(alphabet, alphabet + 64))
+                output.alphabet.clear();
+            nonce_set = true;
+        }
+        else if(arg == "--shard")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing shard argument");
+            auto shard = pop(args);
+            auto slash = shard.find('/');
+            if(slash == std::string::npos)
+                throw std::runtime_error(std::format("Invalid shard '{}', expected i/N", shard));
+            output.shard = parse<uint64_t>(shard.substr(0, slash));
+            output.num_shards = parse<uint64_t>(shard.substr(slash + 1));
+            if(output.num_shards < 1 || output.shard >= output.num_shards)
+                throw std::runtime_error(std::format("Invalid shard '{}', must be i/N with i from 0 to N-1", shard));
+        }
+        else if(arg == "-k" || arg == "--kernel")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing kernel name argument");
+            output.kernel = pop(args);
+        }
+        else if(arg == "--list-kernels")
+        {
+            list_kernels_and_exit();
+        }
+        else if(arg == "--tune")
+        {
+            output.retune = true;
+        }
+        else if(arg == "-c" || arg == "--checkpoint")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing checkpoint file argument");
+            output.checkpoint = pop(args);
+        }
+        else if(arg == "--checkpoint-interval")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing checkpoint interval argument");
+            output.checkpoint_interval = parse<unsigned long>(pop(args));
+            if(output.checkpoint_interval < 1)
+                throw std::runtime_error("Minimum checkpoint interval is 1 second");
+        }
+        else if(arg == "--resume")
+        {
+            output.resume = true;
+        }
+        else if(arg == "--batch")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing batch file argument");
+            output.batch = pop(args);
+        }
+        else if(arg == "--coordinator")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing coordinator address argument");
+            output.coordinator = pop(args);
+        }
+        else if(arg == "--worker")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing coordinator address argument");
+            output.worker = pop(args);
+        }
+        else if(arg == "--verify")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing messages file argument");
+            output.verify = pop(args);
+        }
+        else if(arg == "--lease-size")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing lease size argument");
+            output.lease_size = parse<uint64_t>(pop(args));
+            if(output.lease_size < 1)
+                throw std::runtime_error("Minimum lease size is 1 job");
+        }
+        else if(arg == "--lease-time")
+        {
+            if(args.empty())
+                throw std::runtime_error("Missing lease time argument");
+            output.lease_time = parse<unsigned long>(pop(args));
+            if(output.lease_time < 3)
+                throw std::runtime_error("Minimum lease time is 3 seconds");
+        }
         else if(arg == "-s" || arg == "--start")
         {
             if(args.empty())
                 throw std::runtime_error("Missing start position argument");
             output.start = parse<uint64_t>(pop(args));
-            if(output.start >= max_position)
-                throw std::runtime_error(std::format("Start position must be less than {}", max_position));
             start_or_end_set = true;
         }
         else if(arg == "-e" || arg == "--end")
@@ -652,8 +1168,7 @@ auto parse_arguments(int argc, char** argv)
             if(args.empty())
                 throw std::runtime_error("Missing end position argument");
             output.end = parse<uint64_t>(pop(args));
-            if(output.end > max_position)
-                throw std::runtime_error(std::format("End position must be less than or equal to {}", max_position));
+            end_set = true;
             start_or_end_set = true;
         }
         else
@@ -662,7 +1177,62 @@ auto parse_arguments(int argc, char** argv)
         }
     }
 
-    if(benchmark)
+    // The number of jobs depends on the nonce length
+    uint64_t num_jobs = max_jobs(output.nonce_length);
+    if(!end_set)
+        output.end = num_jobs;
+    if(output.start >= num_jobs)
+        throw std::runtime_error(std::format("Start position must be less than {}", num_jobs));
+    if(output.end > num_jobs)
+        throw std::runtime_error(std::format("End position must be less than or equal to {}", num_jobs));
+
+    if(!output.numa_nodes.empty() && output.affinity == AffinityPolicy::none)
+        throw std::runtime_error("--numa-nodes needs an --affinity policy");
+
+    validate_leaderboard(output);
+
+    if(!output.metrics.empty() && output.report_interval == 0)
+        throw std::runtime_error("--metrics needs a report interval");
+
+    if(!output.coordinator.empty() && !output.worker.empty())
+        throw std::runtime_error("Can't be both coordinator and worker");
+    if(output.num_shards > 1 && (!output.coordinator.empty() || !output.worker.empty() || benchmark))
+        throw std::runtime_error("Can't run a shard as coordinator, worker or benchmark");
+
+    if(!output.verify.empty())
+    {
+        // The messages are read from the file
+        if(!args.empty())
+            throw std::runtime_error("Can't set username and seed with --verify");
+        if(benchmark || start_or_end_set || !output.checkpoint.empty() || !output.batch.empty() || !output.coordinator.empty() || !output.worker.empty())
+            throw std::runtime_error("Can't run benchmark, set start/end position, checkpoint, batch, coordinator or worker with --verify");
+        if(output.difficulty || nonce_set || output.num_shards > 1)
+            throw std::runtime_error("Can't set a target, the nonce or a shard with --verify");
+        return output;
+    }
+    else if(!output.worker.empty())
+    {
+        // The username, seed and jobs come from the coordinator
+        if(!args.empty())
+            throw std::runtime_error("Can't set username and seed for a worker");
+        if(benchmark || start_or_end_set || !output.checkpoint.empty())
+            throw std::runtime_error("Can't run benchmark, set start/end position or checkpoint for a worker");
+        if(nonce_set)
+            throw std::runtime_error("Can't set the nonce length or alphabet for a worker");
+        return output;
+    }
+    else if(!output.batch.empty())
+    {
+        // The targets are read from the file
+        if(!args.empty())
+            throw std::runtime_error("Can't set username and seed in batch mode");
+        if(benchmark || start_or_end_set || !output.checkpoint.empty() || !output.coordinator.empty())
+            throw std::runtime_error("Can't run benchmark, set start/end position, checkpoint or coordinate in batch mode");
+        if(output.difficulty)
+            throw std::runtime_error("Can't set a target in batch mode");
+        return output;
+    }
+    else if(benchmark)
     {
         if(!args.empty())
            throw std::runtime_error("Can't set username and seed when running benchmark");
@@ -686,30 +1256,207 @@ auto parse_arguments(int argc, char** argv)
             throw std::runtime_error("Start position must be less than end position");
     }
 
+    if(output.resume && output.checkpoint.empty())
+        throw std::runtime_error("Can't resume without a checkpoint file");
+
     validate_string(output.user);
     validate_string(output.seed);
 
     return output;
 }
 
+
+// Check the hashes of the messages for --verify and print the best ones
+void run_verify(const Settings& settings)
+{
+    output_message("Verifying {} with {} threads", settings.verify == "-" ? "stdin" : settings.verify, settings.num_threads);
+    auto start_time = std::chrono::high_resolution_clock::now();
+    auto results = verify_messages(settings.verify, settings.num_threads, settings.top);
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> duration = {end_time - start_time};
+
+    int rank = 0;
+    for(auto& record : results.best)
+    {
+        record.rank = settings.top > 1 ? ++rank : 0;
+        output_best(record);
+    }
+    output_message("Verified {} messages in {:.2f}s, {} with the wrong hash, {} other lines skipped",
+        results.num_messages, duration.count(), results.num_mismatches, results.num_skipped);
+}
+
 int main(int argc, char** argv)
 {
+    Settings settings;
     try
     {
-        auto settings = parse_arguments(argc, argv);
-        auto block = create_block(create_padded_prefix(settings.user, settings.seed));
+        settings = parse_arguments(argc, argv);
+    }
+    catch(std::exception& e)
+    {
+        print("Error: {}\n", e.what());
+        return 0;
+    }
+
+    start_output(settings.format);
+    try
+    {
+        if(!settings.verify.empty())
+        {
+            run_verify(settings);
+            stop_output();
+            return 0;
+        }
+
+        std::optional<Connection> connection;
+        if(!settings.worker.empty())
+        {
+            connection.emplace(connect_to(settings.worker));
+            auto reply = connection->request("hello 1");
+            std::istringstream stream(reply);
+            std::string type;
+            stream >> type >> settings.user >> settings.seed;
+            if(type != "task" || stream.fail())
+                throw std::runtime_error(std::format("Invalid reply '{}' from coordinator", reply));
+
+            // The leaderboard and target settings of the coordinator
+            unsigned long top, min_zero_bits;
+            if(stream >> top >> min_zero_bits)
+            {
+                settings.top = top;
+                settings.min_zero_bits = min_zero_bits;
+                validate_leaderboard(settings);
+            }
+            std::string target;
+            if(stream >> target && target != "none")
+                settings.difficulty = parse_difficulty(target);
+
+            // The nonce of the coordinator
+            unsigned nonce_length;
+            std::string nonce_alphabet;
+            if(stream >> nonce_length >> nonce_alphabet)
+            {
+                if(nonce_length < min_nonce_length || nonce_length > max_nonce_length)
+                    throw std::runtime_error(std::format("Invalid nonce length {} from coordinator", nonce_length));
+                settings.nonce_length = nonce_length;
+                if(nonce_alphabet != "base64")
+                {
+                    validate_alphabet(nonce_alphabet);
+                    settings.alphabet = nonce_alphabet;
+                }
+            }
+            validate_string(settings.user);
+            validate_string(settings.seed);
+            output_message("Working on {}/{} for {}", settings.user, settings.seed, settings.worker);
+        }
+
+        if(settings.difficulty)
+            output_message("Stopping at the first hash below {}", format_difficulty(*settings.difficulty));
+
+        std::vector<SearchTarget> targets;
+        if(!settings.batch.empty())
+        {
+            targets = read_targets(settings.batch, max_jobs(settings.nonce_length));
+        }
+        else
+        {
+            auto& target = targets.emplace_back();
+            target.user = settings.user;
+            target.seed = settings.seed;
+            target.start = settings.start;
+            target.end = settings.end;
+        }
+        if(settings.num_shards > 1)
+        {
+            for(auto& target : targets)
+            {
+                if(shard_position(settings, target.start) >= shard_position(settings, target.end))
+                    throw std::runtime_error(std::format("No jobs of shard {}/{} from {} to {} for {}/{}", settings.shard, settings.num_shards, target.start, target.end, target.user, target.seed));
+                target.start = shard_position(settings, target.start);
+                target.end = shard_position(settings, target.end);
+                target.shard = settings.shard;
+                target.num_shards = settings.num_shards;
+            }
+        }
+
+        // Don't throw away the jobs in a checkpoint at the first save
+        if(settings.resume)
+            load_checkpoint(settings, targets.front());
+        else if(!settings.checkpoint.empty() && std::filesystem::exists(settings.checkpoint))
+            throw std::runtime_error(std::format("Checkpoint '{}' already exists, use --resume to continue from it", settings.checkpoint));
+
+        // The coordinator doesn't run any jobs itself
+        Kernels kernels;
+        std::unique_ptr<Searcher> searcher;
+        if(settings.coordinator.empty())
+        {
+            auto topology = get_cpu_topology();
+            auto cpus = plan_affinity(topology, settings.affinity, settings.numa_nodes, settings.num_threads);
+            auto block = create_search_block(targets.front().user, targets.front().seed, settings.nonce_length);
+            if(!settings.kernel.empty())
+                kernels.kernel = &select_kernel(settings.kernel);
+            else
+                kernels = autotune_core_types(block, topology, cpus, settings);
+            if(!kernels.kernel)
+                kernels.kernel = &autotune_kernel(block, settings.num_threads, settings.retune);
+
+            if(!cpus.empty())
+            {
+                std::string list;
+                for(auto cpu : cpus)
+                    list += std::format("{}{}", list.empty() ? "" : ",", cpu);
+                output_message("Pinning the threads to CPU {} ({})", list, affinity_policy_name(settings.affinity));
+            }
+            searcher = std::make_unique<Searcher>(settings.num_threads, cpus);
+            for(auto cpu : searcher->unpinned_cpus())
+                output_message("Can't pin thread to CPU {}", cpu);
+        }
+
+        // A worker creates a search for each lease
+        std::unique_ptr<Search> search;
+        if(!connection)
+        {
+            search = std::make_unique<Search>(targets, make_search_options(settings, kernels, targets));
+        }
+
+        std::signal(SIGINT, handle_signal);
+        std::signal(SIGTERM, handle_signal);
 
         auto start_time = std::chrono::high_resolution_clock::now();
-        run(block, settings.num_threads, settings.start, settings.end);
+        uint64_t hashes_before = searcher ? count_hashes(searcher->counters()) : 0;
+        uint64_t num_jobs;
+        if(!settings.coordinator.empty())
+            num_jobs = run_coordinator(*search, settings);
+        else if(connection)
+            num_jobs = run_worker(*connection, *searcher, search, kernels, settings);
+        else
+            num_jobs = run(*searcher, *search, kernels, settings);
         auto end_time = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> duration = {end_time - start_time};
-        uint64_t num = std::max(UINT64_C(1), (settings.end - settings.start) << 24);
+        // The coordinator only knows the jobs that the workers finished
+        uint64_t num_hashes = searcher ? count_hashes(searcher->counters()) - hashes_before : num_jobs << 24;
+
+        for(size_t i = 0; search && i < search->num_targets(); i++)
+        {
+            auto& target = search->target(i);
+            int rank = 0;
+            for(auto& result : search->best(i))
+            {
+                auto record = make_result_record(target.user, target.seed, result);
+                record.rank = settings.top > 1 ? ++rank : 0;
+                output_best(record);
+            }
+        }
 
-        print("{:.2f}s {:.0f}MH/s\n", duration.count(), (num / duration.count()) / 1e6);
+        if(settings.difficulty && !(search && search->hit()) && settings.worker.empty())
+            output_message("No hash below the target was found");
+
+        output_summary(duration.count(), num_jobs, num_hashes);
     }
     catch(std::exception& e)
     {
-        print("Error: {}\n", e.what());
+        output_error(e.what());
     }
+    stop_output();
     return 0;
 }
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// The base64 alphabet, used for the nonce characters unless another
+// alphabet is given
+extern uint8_t alphabet[65];
+
+// The SHA-256 state before the first block
+inline constexpr std::array<uint32_t, 8> sha256_initial_state {
+    0x6a09e667U, 0xbb67ae85U, 0x3c6ef372U, 0xa54ff53aU,
+    0x510e527fU, 0x9b05688cU, 0x1f83d9abU, 0x5be0cd19U
+};
+
+// Process whole 64 byte blocks (see sha256-x86.cpp and sha256-generic.cpp)
+void sha256_process_x86(uint32_t state[8], const uint8_t data[], uint32_t length);
+void sha256_process_generic(uint32_t state[8], const uint8_t data[], uint32_t length);
+
+// Same as above, using the SHA extensions when available
+void sha256_process(uint32_t state[8], const uint8_t data[], uint32_t length);
+
+// Process the blocks of L messages of the same length at the same time
+// with the SHA extensions (see sha256-multi.cpp)
+template<int L>
+void sha256_process_x86_multi(uint32_t* const state[], const uint8_t* const data[], uint32_t length);
+
+// The same for 16 messages with AVX-512 (see kernel-avx512.cpp)
+void sha256_process_avx512_multi(uint32_t* const state[], const uint8_t* const data[], uint32_t length);
+
+// Process the blocks of num messages of the same length, several at a
+// time when the SHA extensions are available
+void sha256_process_multi(uint32_t* const state[], const uint8_t* const data[], size_t num, uint32_t length);
+
+// Update the best result if the given result is better. The result is
+// the first 128 bits of the state (A, B, E and F) after the final
+// round, and the block is the last block of the message.
+void submit_result(const std::array<uint32_t, 4>& result, const std::array<uint8_t, 64>& block);
+
+// Number of values of the first 3 varying characters (bytes 48-50) in
+// a chunk. Each of them covers 64 hashes.
+const uint32_t chunk_size = 64*64*64;
+
+// How a chunk is run. The kernels only submit results where the bits
+// of the first word of the hash given by result_mask are 0. If cancel
+// is set, the kernel returns before the next value of i012 once it is
+// true, without finishing the range. The 4 characters at bytes 48-51
+// are taken from the 64 characters of alphabet.
+struct ChunkOptions
+{
+    uint32_t result_mask = 0xffffffffU;
+    const std::atomic<bool>* cancel = nullptr;
+    const uint8_t* alphabet = ::alphabet;
+};
+
+// Check the hash of the strings in a chunk. The state is the SHA-256
+// state before the input block, which is the last block of the
+// message. All 2^24 strings are checked when i012_begin is 0 and
+// i012_end is chunk_size.
+template<int L>
+void process_chunk_sha(
+    const std::array<uint32_t, 8>& state, const std::array<uint8_t, 64>& input_data,
+    uint32_t i012_begin, uint32_t i012_end, const ChunkOptions& options);
+void process_chunk_avx2(
+    const std::array<uint32_t, 8>& state, const std::array<uint8_t, 64>& input_data,
+    uint32_t i012_begin, uint32_t i012_end, const ChunkOptions& options);
+void process_chunk_avx512(
+    const std::array<uint32_t, 8>& state, const std::array<uint8_t, 64>& input_data,
+    uint32_t i012_begin, uint32_t i012_end, const ChunkOptions& options);
+
+// A search kernel and the CPU features it needs
+struct Kernel
+{
+    const char* name;
+    const char* description;
+    bool (*supported)();
+    void (*process_chunk)(
+        const std::array<uint32_t, 8>& state, const std::array<uint8_t, 64>& input_data,
+        uint32_t i012_begin, uint32_t i012_end, const ChunkOptions& options);
+};
+
+// All kernels, fastest first (see kernels.cpp)
+const std::vector<Kernel>& get_kernels();
+
+// Get the kernel with the given name, or the fastest kernel supported
+// by this CPU if the name is empty
+const Kernel& select_kernel(const std::string& name);
+
+// Time all kernels supported by this CPU with the given number of
+// threads and return the fastest. The choice is cached per CPU model
+// unless retune is set (see autotune.cpp). If cpus is given, the threads
+// are pinned to them, and the choice is cached for the cores named by
+// cores (e.g. "E-cores").
+const Kernel& autotune_kernel(
+    const std::array<uint8_t, 64>& block, unsigned long num_threads, bool retune,
+    const std::vector<int>& cpus = {}, const std::string& cores = "");
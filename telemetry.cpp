@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <format>
+#include "output.hpp"
+#include "telemetry.hpp"
+
+namespace
+{
+    // The weight of the newest rate in the moving average
+    const double average_weight = 0.25;
+
+    // Written to a temporary file first, so that the node exporter never
+    // reads a partial file. Failing to write it is not an error, it is
+    // written again at the next report.
+    void write_metrics(const std::filesystem::path& path, const std::string& text)
+    {
+        auto temp_path = path;
+        temp_path += ".tmp";
+        {
+            std::ofstream file(temp_path, std::ios::trunc);
+            file << text;
+            if(!file)
+                return;
+        }
+        std::error_code error;
+        std::filesystem::rename(temp_path, path, error);
+    }
+}
+
+uint64_t count_hashes(const std::vector<ThreadCounter>& counters)
+{
+    uint64_t output = 0;
+    for(auto& counter : counters)
+        output += counter.hashes.load(std::memory_order_relaxed);
+    return output;
+}
+
+RateReporter::RateReporter(const std::vector<ThreadCounter>& counters, double total_hashes, const std::string& metrics_path) :
+    counters(counters),
+    total_hashes(total_hashes),
+    metrics_path(metrics_path),
+    last_time(clock::now()),
+    last_hashes(counters.size()),
+    average(counters.size())
+{
+    for(size_t i = 0; i < counters.size(); i++)
+        last_hashes[i] = counters[i].hashes.load(std::memory_order_relaxed);
+    start_hashes = last_hashes;
+}
+
+void RateReporter::report()
+{
+    auto now = clock::now();
+    double seconds = std::chrono::duration<double>(now - last_time).count();
+    if(seconds <= 0)
+        return;
+    last_time = now;
+
+    RateRecord record;
+    record.rate = 0;
+    uint64_t done = 0;
+    std::vector<uint64_t> hashes(counters.size());
+    for(size_t i = 0; i < counters.size(); i++)
+    {
+        hashes[i] = counters[i].hashes.load(std::memory_order_relaxed);
+        double rate = double(hashes[i] - last_hashes[i]) / seconds / 1e6;
+        average[i] = first ? rate : average[i] + (rate - average[i]) * average_weight;
+        record.thread_rate.push_back(rate);
+        record.thread_average.push_back(average[i]);
+        record.rate += rate;
+        done += hashes[i] - start_hashes[i];
+    }
+    total_average = first ? record.rate : total_average + (record.rate - total_average) * average_weight;
+    record.average = total_average;
+    last_hashes = hashes;
+    first = false;
+
+    double left = std::max(0.0, total_hashes - double(done));
+    record.eta = total_average > 0 ? left / (total_average * 1e6) : -1;
+    output_rate(record);
+
+    if(metrics_path.empty())
+        return;
+
+    std::string text;
+    text += "# HELP shallenge_hashes_total Hashes calculated by each thread.\n";
+    text += "# TYPE shallenge_hashes_total counter\n";
+    for(size_t i = 0; i < counters.size(); i++)
+        text += std::format("shallenge_hashes_total{{thread=\"{}\"}} {}\n", i, hashes[i]);
+    text += "# HELP shallenge_hash_rate Hashes per second of each thread, moving average.\n";
+    text += "# TYPE shallenge_hash_rate gauge\n";
+    for(size_t i = 0; i < counters.size(); i++)
+        text += std::format("shallenge_hash_rate{{thread=\"{}\"}} {:.0f}\n", i, average[i] * 1e6);
+    text += "# HELP shallenge_hashes_remaining Hashes left until the end of the range.\n";
+    text += "# TYPE shallenge_hashes_remaining gauge\n";
+    text += std::format("shallenge_hashes_remaining {:.0f}\n", left);
+    if(record.eta >= 0)
+    {
+        text += "# HELP shallenge_eta_seconds Estimated seconds until the end of the range.\n";
+        text += "# TYPE shallenge_eta_seconds gauge\n";
+        text += std::format("shallenge_eta_seconds {:.0f}\n", record.eta);
+    }
+    write_metrics(metrics_path, text);
+}
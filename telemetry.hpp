@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// The number of hashes done by a thread. Each counter is only written by
+// its own thread, and is on its own cache line so that the threads don't
+// slow each other down.
+struct alignas(64) ThreadCounter
+{
+    std::atomic<uint64_t> hashes = 0;
+
+    void add(uint64_t num)
+    {
+        hashes.store(hashes.load(std::memory_order_relaxed) + num, std::memory_order_relaxed);
+    }
+};
+
+// The hashes done by all threads
+uint64_t count_hashes(const std::vector<ThreadCounter>& counters);
+
+// Reads the thread counters now and then, and prints the rate of each
+// thread and the total, both since the last report and as a moving
+// average, and the time left. The total number of hashes is a double
+// because the whole range has 2^72 of them, and it only counts the hashes
+// done after the reporter was created, since the counters of a Searcher
+// go on across searches. The same numbers are written to a Prometheus
+// text file if a path is given.
+class RateReporter
+{
+public:
+    RateReporter(const std::vector<ThreadCounter>& counters, double total_hashes, const std::string& metrics_path);
+
+    void report();
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    const std::vector<ThreadCounter>& counters;
+    double total_hashes;
+    std::string metrics_path;
+    clock::time_point last_time;
+    std::vector<uint64_t> start_hashes;
+    std::vector<uint64_t> last_hashes;
+    std::vector<double> average;
+    double total_average = 0;
+    bool first = true;
+};
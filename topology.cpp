@@ -0,0 +1,302 @@
+#if defined(__linux__)
+#include <sched.h>
+#endif
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <format>
+#include "cpuid.hpp"
+#include "topology.hpp"
+
+namespace
+{
+    // Parse a list like "0-3,8-11"
+    std::vector<int> parse_cpu_list(const std::string& text)
+    {
+        std::vector<int> output;
+        std::istringstream stream(text);
+        std::string item;
+        while(std::getline(stream, item, ','))
+        {
+            if(item.empty() || item == "\n")
+                continue;
+            auto dash = item.find('-');
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            for(int cpu = first; cpu <= last; cpu++)
+                output.push_back(cpu);
+        }
+        return output;
+    }
+
+    std::string read_line(const std::filesystem::path& path)
+    {
+        std::ifstream file(path);
+        std::string line;
+        std::getline(file, line);
+        return line;
+    }
+
+    int read_int(const std::filesystem::path& path, int fallback)
+    {
+        auto line = read_line(path);
+        if(line.empty())
+            return fallback;
+        return std::stoi(line);
+    }
+
+    // The core type of each online CPU, or nothing if sysfs doesn't
+    // tell. Newer kernels give the relative capacity of each CPU, which
+    // is lower on the smaller cores. Capacities within 20% of each other
+    // are the same type, since the P-cores can differ a little in their
+    // maximum frequency. Older kernels only list the Intel E-cores, as
+    // the CPUs of the cpu_atom PMU.
+    std::map<int, int> read_core_types(const std::filesystem::path& root)
+    {
+        std::map<int, int> output;
+        auto online = parse_cpu_list(read_line(root / "cpu" / "online"));
+
+        std::vector<std::pair<int, int>> capacities;
+        for(int cpu : online)
+        {
+            int capacity = read_int(root / "cpu" / std::format("cpu{}", cpu) / "cpu_capacity", 0);
+            if(capacity > 0)
+                capacities.emplace_back(capacity, cpu);
+        }
+        if(!capacities.empty())
+        {
+            std::sort(capacities.rbegin(), capacities.rend());
+            int type = 0;
+            int type_capacity = capacities.front().first;
+            for(auto [capacity, cpu] : capacities)
+            {
+                if(capacity < type_capacity * 4 / 5)
+                {
+                    type++;
+                    type_capacity = capacity;
+                }
+                output[cpu] = type;
+            }
+            return output;
+        }
+
+        std::error_code error;
+        auto atom_cpus = root.parent_path() / "cpu_atom" / "cpus";
+        if(std::filesystem::exists(atom_cpus, error))
+        {
+            for(int cpu : online)
+                output[cpu] = 0;
+            for(int cpu : parse_cpu_list(read_line(atom_cpus)))
+                output[cpu] = 1;
+        }
+        return output;
+    }
+
+    bool is_allowed(int cpu)
+    {
+#if defined(__linux__)
+        static const cpu_set_t allowed = []() {
+            cpu_set_t output;
+            CPU_ZERO(&output);
+            if(sched_getaffinity(0, sizeof(output), &output) != 0)
+            {
+                for(int i = 0; i < CPU_SETSIZE; i++)
+                    CPU_SET(i, &output);
+            }
+            return output;
+        }();
+        return cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed);
+#else
+        (void)cpu;
+        return true;
+#endif
+    }
+}
+
+std::vector<CpuInfo> get_cpu_topology(const std::string& sysfs)
+{
+    std::vector<CpuInfo> output;
+    std::filesystem::path root = sysfs;
+    std::error_code error;
+    if(!std::filesystem::exists(root / "cpu" / "online", error))
+        return output;
+
+    // Node of each CPU. Machines without NUMA have no node directory,
+    // and then all CPUs are on node 0.
+    std::map<int, int> cpu_node;
+    for(auto& entry : std::filesystem::directory_iterator(root / "node", error))
+    {
+        auto name = entry.path().filename().string();
+        if(!name.starts_with("node") || name.size() == 4 || !std::isdigit((unsigned char)name[4]))
+            continue;
+        int node = std::stoi(name.substr(4));
+        for(int cpu : parse_cpu_list(read_line(entry.path() / "cpulist")))
+            cpu_node[cpu] = node;
+    }
+
+    auto core_types = read_core_types(root);
+
+    for(int cpu : parse_cpu_list(read_line(root / "cpu" / "online")))
+    {
+        if(!is_allowed(cpu))
+            continue;
+
+        auto topology = root / "cpu" / std::format("cpu{}", cpu) / "topology";
+        CpuInfo info;
+        info.id = cpu;
+        info.node = cpu_node.contains(cpu) ? cpu_node[cpu] : 0;
+        info.package = read_int(topology / "physical_package_id", 0);
+        info.core = read_int(topology / "core_id", cpu);
+
+        // The position in the sibling list, so that the first thread of
+        // each core is 0
+        auto siblings = parse_cpu_list(read_line(topology / "thread_siblings_list"));
+        auto it = std::find(siblings.begin(), siblings.end(), cpu);
+        info.thread = it == siblings.end() ? 0 : int(it - siblings.begin());
+        info.core_type = core_types.contains(cpu) ? core_types[cpu] : 0;
+        output.push_back(info);
+    }
+    return output;
+}
+
+int num_core_types(const std::vector<CpuInfo>& cpus)
+{
+    int output = 1;
+    for(auto& cpu : cpus)
+        output = std::max(output, cpu.core_type + 1);
+    return output;
+}
+
+std::string core_type_name(int type, int num_types)
+{
+    if(num_types == 2)
+        return type == 0 ? "P-cores" : "E-cores";
+    return std::format("type {} cores", type);
+}
+
+int current_core_type()
+{
+#if defined(__linux__)
+    static const std::map<int, int> core_types = read_core_types("/sys/devices/system");
+    if(!core_types.empty())
+    {
+        auto it = core_types.find(sched_getcpu());
+        return it == core_types.end() ? 0 : it->second;
+    }
+#endif
+
+    // Intel hybrid CPUs give the type of the current core in leaf 0x1a,
+    // 0x20 for the E-cores (Atom) and 0x40 for the P-cores (Core)
+    uint32_t regs[4];
+    cpuid(0, 0, regs);
+    if(regs[0] < 0x1a)
+        return 0;
+    cpuid(7, 0, regs);
+    if(!((regs[3] >> 15) & 1))
+        return 0;
+    cpuid(0x1a, 0, regs);
+    return (regs[0] >> 24) == 0x20 ? 1 : 0;
+}
+
+AffinityPolicy parse_affinity_policy(const std::string& name)
+{
+    if(name == "none")
+        return AffinityPolicy::none;
+    if(name == "compact")
+        return AffinityPolicy::compact;
+    if(name == "scatter")
+        return AffinityPolicy::scatter;
+    if(name == "physical")
+        return AffinityPolicy::physical;
+    throw std::runtime_error(std::format("Unknown affinity policy '{}', expected compact, scatter, physical or none", name));
+}
+
+const char* affinity_policy_name(AffinityPolicy policy)
+{
+    switch(policy)
+    {
+    case AffinityPolicy::compact: return "compact";
+    case AffinityPolicy::scatter: return "scatter";
+    case AffinityPolicy::physical: return "physical";
+    default: return "none";
+    }
+}
+
+std::vector<int> plan_affinity(
+    const std::vector<CpuInfo>& all_cpus, AffinityPolicy policy,
+    const std::vector<int>& nodes, unsigned long num_threads)
+{
+    if(policy == AffinityPolicy::none)
+        return {};
+    if(all_cpus.empty())
+        throw std::runtime_error("Thread affinity needs the CPU topology from sysfs, which is not available");
+
+    std::vector<CpuInfo> cpus;
+    for(auto& cpu : all_cpus)
+    {
+        if(nodes.empty() || std::find(nodes.begin(), nodes.end(), cpu.node) != nodes.end())
+            cpus.push_back(cpu);
+    }
+    if(cpus.empty())
+        throw std::runtime_error("There are no CPUs in the given NUMA nodes");
+
+    auto compact_order = [](const CpuInfo& cpu) {
+        return std::make_tuple(cpu.node, cpu.package, cpu.core, cpu.thread, cpu.id);
+    };
+    auto physical_order = [](const CpuInfo& cpu) {
+        return std::make_tuple(cpu.thread, cpu.node, cpu.package, cpu.core, cpu.id);
+    };
+
+    if(policy == AffinityPolicy::compact)
+    {
+        std::sort(cpus.begin(), cpus.end(), [&](auto& a, auto& b) { return compact_order(a) < compact_order(b); });
+    }
+    else
+    {
+        std::sort(cpus.begin(), cpus.end(), [&](auto& a, auto& b) { return physical_order(a) < physical_order(b); });
+        if(policy == AffinityPolicy::scatter)
+        {
+            // Take the CPUs of each node in the physical cores first
+            // order, one node at a time
+            std::map<int, int> node_count;
+            std::vector<std::pair<int, int>> rank;
+            for(auto& cpu : cpus)
+                rank.emplace_back(node_count[cpu.node]++, cpu.node);
+            std::vector<size_t> index(cpus.size());
+            for(size_t i = 0; i < index.size(); i++)
+                index[i] = i;
+            std::stable_sort(index.begin(), index.end(), [&](size_t a, size_t b) { return rank[a] < rank[b]; });
+            std::vector<CpuInfo> sorted;
+            for(auto i : index)
+                sorted.push_back(cpus[i]);
+            cpus = sorted;
+        }
+    }
+
+    std::vector<int> output;
+    for(unsigned long i = 0; i < num_threads; i++)
+        output.push_back(cpus[i % cpus.size()].id);
+    return output;
+}
+
+bool pin_thread(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// A logical CPU and where it is in the machine. thread is the index of
+// the CPU among the SMT siblings of its core. core_type tells the types
+// of cores apart on hybrid CPUs, like the P-cores and E-cores of Intel
+// Alder Lake. Type 0 is the fastest, and all CPUs are type 0 on CPUs
+// with one type of core.
+struct CpuInfo
+{
+    int id;
+    int node;
+    int package;
+    int core;
+    int thread;
+    int core_type;
+};
+
+// The CPUs this process is allowed to run on, read from sysfs. Empty if
+// the topology is not available (Windows, or no sysfs).
+std::vector<CpuInfo> get_cpu_topology(const std::string& sysfs = "/sys/devices/system");
+
+// The number of core types, 1 unless the CPU is hybrid
+int num_core_types(const std::vector<CpuInfo>& cpus);
+
+// "P-cores" and "E-cores" when there are two types, otherwise "type N
+// cores"
+std::string core_type_name(int type, int num_types);
+
+// The type of the core the calling thread is running on now. This is
+// looked up by the CPU number in sysfs, or read from the hybrid CPUID
+// leaf if sysfs doesn't have it.
+int current_core_type();
+
+// How the threads are placed on the CPUs
+//   compact:  fill one core (all SMT siblings) before the next, and one
+//             node before the next
+//   scatter:  alternate between the NUMA nodes, using the physical
+//             cores of each node before their SMT siblings
+//   physical: one thread per physical core first, then the siblings
+enum class AffinityPolicy
+{
+    none,
+    compact,
+    scatter,
+    physical
+};
+
+AffinityPolicy parse_affinity_policy(const std::string& name);
+const char* affinity_policy_name(AffinityPolicy policy);
+
+// The CPU for each of the threads. Only the CPUs in the given NUMA nodes
+// are used, unless nodes is empty. If there are more threads than CPUs,
+// the CPUs are used again from the start.
+std::vector<int> plan_affinity(
+    const std::vector<CpuInfo>& cpus, AffinityPolicy policy,
+    const std::vector<int>& nodes, unsigned long num_threads);
+
+// Pin the calling thread to the CPU. Returns false if that fails.
+bool pin_thread(int cpu);
@@ -0,0 +1,419 @@
+#include <cstdio>
+#include <cstdint>
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <format>
+#include "shallenge.hpp"
+#include "output.hpp"
+#include "verify.hpp"
+
+//
+// --verify reads lines like these:
+//
+//   benchmark/shallenge/////////////////////AAAAAABljV0W
+//   00000000 e69407dd 08596643 8a925ab9 96dccfe0 8dd914b8 ddfe27f3 7e176b9f benchmark/shallenge/////////////////////AAAAAABljV0W
+//   Best #1: 00000000 e69407dd 08596643 8a925ab9 96dccfe0 8dd914b8 ddfe27f3 7e176b9f benchmark/shallenge/////////////////////AAAAAABljV0W
+//   {"type":"best","hash":"00000000e69407dd...","message":"benchmark/shallenge/////////////////////AAAAAABljV0W",...}
+//
+// That is a message on its own, or a result in the text or JSON output
+// of shallenge, whose hash must match the message. All other lines
+// (e.g. "Progress: 1024") are skipped, so the whole output of many runs
+// can be checked in one go.
+//
+// The input is read in chunks of whole lines, which the threads take
+// from a queue. Each thread pads the messages of a chunk to whole blocks
+// and hashes the messages with the same number of blocks together with
+// sha256_process_multi, which runs 16 of them in AVX-512 vectors or
+// interleaves 4 on the SHA unit. The threads keep their own best
+// results, which are merged at the end.
+//
+
+namespace
+{
+    // Bytes read at a time, the chunks are this size up to the last
+    // complete line
+    const size_t chunk_bytes = 1 << 20;
+
+    struct Chunk
+    {
+        std::string text;
+        uint64_t first_line;
+    };
+
+    // A message of a chunk, padded to num_blocks blocks at offset in the
+    // blocks of the thread. hash is the hash given in the line, if any.
+    struct Message
+    {
+        size_t offset;
+        uint32_t length;
+        uint32_t num_blocks;
+        bool has_hash;
+        std::array<uint32_t, 8> hash;
+        uint64_t line;
+    };
+
+    struct Verified
+    {
+        std::array<uint32_t, 8> hash;
+        std::string message;
+    };
+
+    // The chunks that are read and not yet taken by a thread, at most
+    // max_queued of them
+    struct ChunkQueue
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Chunk> chunks;
+        size_t max_queued;
+        bool finished = false;
+    };
+
+    // What a thread found, and the buffers it reuses for each chunk
+    struct ThreadState
+    {
+        uint64_t num_messages = 0;
+        uint64_t num_mismatches = 0;
+        uint64_t num_skipped = 0;
+        std::vector<Verified> best;
+
+        std::vector<uint8_t> blocks;
+        std::vector<Message> messages;
+        std::vector<uint32_t> order;
+        std::vector<std::array<uint32_t, 8>> states;
+        std::vector<uint32_t*> state_ptrs;
+        std::vector<const uint8_t*> data_ptrs;
+    };
+
+    std::string format_hash(const std::array<uint32_t, 8>& hash)
+    {
+        std::string output;
+        for(auto word : hash)
+            output += std::format("{:08x}", word);
+        return output;
+    }
+
+    bool parse_hex(std::string_view text, uint32_t& value)
+    {
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value, 16);
+        return error == std::errc() && end == text.data() + text.size();
+    }
+
+    // 8 words of 8 hex digits, with or without spaces between them
+    bool parse_hash(const std::string_view* words, std::array<uint32_t, 8>& hash)
+    {
+        for(int i = 0; i < 8; i++)
+        {
+            if(words[i].size() != 8 || !parse_hex(words[i], hash[i]))
+                return false;
+        }
+        return true;
+    }
+
+    // The string value of "name" in a JSON object, appended to output
+    // without the escapes. Returns false if there is none.
+    bool find_json_string(std::string_view line, std::string_view name, std::vector<uint8_t>& output)
+    {
+        auto pos = line.find(std::format("\"{}\":\"", name));
+        if(pos == std::string_view::npos)
+            return false;
+        for(pos += name.size() + 4; pos < line.size(); pos++)
+        {
+            char ch = line[pos];
+            if(ch == '"')
+                return true;
+            if(ch == '\\')
+            {
+                // Only \" and \\ can be in a message
+                if(++pos == line.size() || (line[pos] != '"' && line[pos] != '\\'))
+                    return false;
+                ch = line[pos];
+            }
+            output.push_back(uint8_t(ch));
+        }
+        return false;
+    }
+
+    // Append the message of the line to blocks. Returns false if the
+    // line has no message.
+    bool parse_line(std::string_view line, std::vector<uint8_t>& blocks, Message& message)
+    {
+        message.offset = blocks.size();
+        message.has_hash = false;
+
+        if(line.front() == '{')
+        {
+            std::vector<uint8_t> hash;
+            if(find_json_string(line, "hash", hash))
+            {
+                if(hash.size() != 64)
+                    return false;
+                std::string_view words[8];
+                for(int i = 0; i < 8; i++)
+                    words[i] = std::string_view(reinterpret_cast<const char*>(hash.data()) + 8*i, 8);
+                if(!parse_hash(words, message.hash))
+                    return false;
+                message.has_hash = true;
+            }
+            if(!find_json_string(line, "message", blocks))
+            {
+                blocks.resize(message.offset);
+                return false;
+            }
+        }
+        else
+        {
+            // The message is the last word, and the 8 words before it
+            // are the hash if there are more words. A result has at
+            // most "Best #1:" in front of the hash.
+            std::string_view words[11];
+            size_t num_words = 0;
+            for(size_t pos = 0; pos < line.size();)
+            {
+                if(num_words == 11)
+                    return false;
+                auto end = std::min(line.find_first_of(" \t", pos), line.size());
+                words[num_words++] = line.substr(pos, end - pos);
+                pos = std::min(line.find_first_not_of(" \t", end), line.size());
+            }
+            if(num_words >= 9)
+            {
+                if(!parse_hash(&words[num_words - 9], message.hash))
+                    return false;
+                message.has_hash = true;
+            }
+            else if(num_words != 1)
+            {
+                return false;
+            }
+            auto& text = words[num_words - 1];
+            blocks.insert(blocks.end(), text.begin(), text.end());
+        }
+
+        // Pad the message to whole blocks
+        uint64_t length = blocks.size() - message.offset;
+        message.length = uint32_t(length);
+        message.num_blocks = uint32_t((length + 9 + 63) / 64);
+        blocks.push_back(0x80);
+        blocks.resize(message.offset + 64*message.num_blocks - 8, 0);
+        for(int i = 7; i >= 0; i--)
+            blocks.push_back(uint8_t((length * 8) >> (8*i)));
+        return true;
+    }
+
+    void add_best(std::vector<Verified>& best, size_t top, const std::array<uint32_t, 8>& hash, std::string_view message)
+    {
+        if(best.size() >= top && hash >= best.back().hash)
+            return;
+
+        auto it = std::lower_bound(best.begin(), best.end(), hash,
+            [](const Verified& verified, const std::array<uint32_t, 8>& value) { return verified.hash < value; });
+        for(auto same = it; same != best.end() && same->hash == hash; ++same)
+        {
+            if(same->message == message)
+                return;
+        }
+
+        best.insert(it, { hash, std::string(message) });
+        if(best.size() > top)
+            best.pop_back();
+    }
+
+    void verify_chunk(const Chunk& chunk, ThreadState& state, size_t top)
+    {
+        auto& blocks = state.blocks;
+        auto& messages = state.messages;
+        blocks.clear();
+        messages.clear();
+
+        uint64_t line_number = chunk.first_line;
+        std::string_view text = chunk.text;
+        while(!text.empty())
+        {
+            auto end = std::min(text.find('\n'), text.size());
+            auto line = text.substr(0, end);
+            text.remove_prefix(std::min(end + 1, text.size()));
+
+            auto begin = line.find_first_not_of(" \t\r");
+            if(begin != std::string_view::npos)
+            {
+                line = line.substr(begin, line.find_last_not_of(" \t\r") + 1 - begin);
+                Message message;
+                message.line = line_number;
+                if(parse_line(line, blocks, message))
+                    messages.push_back(message);
+                else
+                    state.num_skipped++;
+            }
+            line_number++;
+        }
+
+        // Hash the messages with the same number of blocks together
+        auto& order = state.order;
+        order.resize(messages.size());
+        for(uint32_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return messages[a].num_blocks < messages[b].num_blocks; });
+
+        state.states.assign(messages.size(), sha256_initial_state);
+        state.state_ptrs.resize(messages.size());
+        state.data_ptrs.resize(messages.size());
+        for(size_t i = 0; i < order.size(); i++)
+        {
+            state.state_ptrs[i] = state.states[order[i]].data();
+            state.data_ptrs[i] = blocks.data() + messages[order[i]].offset;
+        }
+        for(size_t begin = 0, end; begin < order.size(); begin = end)
+        {
+            uint32_t num_blocks = messages[order[begin]].num_blocks;
+            for(end = begin; end < order.size() && messages[order[end]].num_blocks == num_blocks; end++)
+            {
+            }
+            sha256_process_multi(&state.state_ptrs[begin], &state.data_ptrs[begin], end - begin, 64*num_blocks);
+        }
+
+        for(size_t i = 0; i < messages.size(); i++)
+        {
+            auto& message = messages[i];
+            auto& hash = state.states[i];
+            std::string_view text(reinterpret_cast<const char*>(blocks.data()) + message.offset, message.length);
+            if(message.has_hash && message.hash != hash)
+            {
+                output_error(std::format("Line {}: the hash of {} is {}, not {}", message.line, text, format_hash(hash), format_hash(message.hash)));
+                state.num_mismatches++;
+                continue;
+            }
+            add_best(state.best, top, hash, text);
+        }
+        state.num_messages += messages.size();
+    }
+
+    void verify_thread(ChunkQueue& queue, ThreadState& state, size_t top)
+    {
+        for(;;)
+        {
+            Chunk chunk;
+            {
+                std::unique_lock lock(queue.mutex);
+                queue.cv.wait(lock, [&]() { return !queue.chunks.empty() || queue.finished; });
+                if(queue.chunks.empty())
+                    return;
+                chunk = std::move(queue.chunks.front());
+                queue.chunks.pop_front();
+            }
+            queue.cv.notify_all();
+            verify_chunk(chunk, state, top);
+        }
+    }
+
+    // Read the file in chunks of whole lines and put them in the queue
+    void read_chunks(FILE* file, ChunkQueue& queue)
+    {
+        std::string rest;
+        uint64_t line_number = 1;
+        for(;;)
+        {
+            std::string text = std::move(rest);
+            rest.clear();
+            size_t size = text.size();
+            text.resize(size + chunk_bytes);
+            size_t num_read = std::fread(text.data() + size, 1, chunk_bytes, file);
+            text.resize(size + num_read);
+            if(std::ferror(file))
+                throw std::runtime_error("Can't read the messages");
+            bool at_end = num_read == 0;
+
+            // Keep the last line for the next chunk if it isn't complete
+            if(!at_end)
+            {
+                auto last = text.rfind('\n');
+                if(last == std::string::npos)
+                {
+                    rest = std::move(text);
+                    continue;
+                }
+                rest.assign(text, last + 1);
+                text.resize(last + 1);
+            }
+
+            if(!text.empty())
+            {
+                uint64_t num_lines = uint64_t(std::count(text.begin(), text.end(), '\n'));
+                std::unique_lock lock(queue.mutex);
+                queue.cv.wait(lock, [&]() { return queue.chunks.size() < queue.max_queued; });
+                queue.chunks.push_back({ std::move(text), line_number });
+                line_number += num_lines;
+                lock.unlock();
+                queue.cv.notify_all();
+            }
+            if(at_end)
+                return;
+        }
+    }
+}
+
+VerifyResults verify_messages(const std::string& path, unsigned long num_threads, size_t top)
+{
+    FILE* file = path == "-" ? stdin : std::fopen(path.c_str(), "rb");
+    if(!file)
+        throw std::runtime_error(std::format("Can't read file '{}'", path));
+
+    ChunkQueue queue;
+    queue.max_queued = 2 * num_threads;
+    std::vector<ThreadState> states(num_threads);
+    std::vector<std::thread> threads;
+    for(auto& state : states)
+        threads.emplace_back(verify_thread, std::ref(queue), std::ref(state), top);
+
+    // The threads must be stopped before an error is passed on
+    std::exception_ptr error;
+    try
+    {
+        read_chunks(file, queue);
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    {
+        std::lock_guard lock(queue.mutex);
+        queue.finished = true;
+    }
+    queue.cv.notify_all();
+    for(auto& thread : threads)
+        thread.join();
+    if(file != stdin)
+        std::fclose(file);
+    if(error)
+        std::rethrow_exception(error);
+
+    VerifyResults output;
+    std::vector<Verified> best;
+    for(auto& state : states)
+    {
+        output.num_messages += state.num_messages;
+        output.num_mismatches += state.num_mismatches;
+        output.num_skipped += state.num_skipped;
+        for(auto& verified : state.best)
+            add_best(best, top, verified.hash, verified.message);
+    }
+    for(auto& verified : best)
+    {
+        ResultRecord record {};
+        record.hash = verified.hash;
+        record.message = verified.message;
+        record.thread = -1;
+        output.best.push_back(record);
+    }
+    return output;
+}
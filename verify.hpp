@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "output.hpp"
+
+// What verify_messages found. best has the best hashes, best first, and
+// only the hash and message of each are set.
+struct VerifyResults
+{
+    uint64_t num_messages = 0;
+    uint64_t num_mismatches = 0;
+    uint64_t num_skipped = 0;
+    std::vector<ResultRecord> best;
+};
+
+// Hash the messages in the lines of the file at path ("-" for stdin) on
+// num_threads threads, and keep the top best of them (see verify.cpp
+// for the lines that are read). Lines with a hash that is not the hash
+// of their message are reported with output_error.
+VerifyResults verify_messages(const std::string& path, unsigned long num_threads, size_t top);